@@ -0,0 +1,1158 @@
+/*
+  Vitali - Vita License database updater
+  Copyright © 2017-2018 - VitaSmith
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Vitali benchmark suite: generates deterministic synthetic zRIF feeds (CSV,
+ * XML, XLSX, a wide NoPayStation style TSV and a tree of .rif files), and
+ * times the decoding and scanning primitives on them. The end-to-end ingestion
+ * of the feeds is timed by running vitali itself (see 'make bench'). With
+ * --check, only the self-checks are run, including one of a ZIP64 archive over
+ * 4 GB (see 'make check').
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#if defined(_WIN32)
+#include <direct.h>
+#define mkdir(path, mode)   _mkdir(path)
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "csv.h"
+#include "puff.h"
+#include "zrif.h"
+#include "unzip.h"
+#include "xml.h"
+#include "stats.h"
+
+#define MAX_ZRIF_LENGTH     2048
+#define MAX_BENCHMARKS      16
+/* Number of RIFs that encode_zrif() is checked and timed against */
+#define NB_SAMPLE_RIFS      1024
+/* Stored member that pushes the shared strings of the ZIP64 check past 4 GB, left as a hole in the file */
+#define ZIP64_HOLE_SIZE     (0x100000000ULL + 1024 * 1024)
+#define ZIP64_EXTRA_ID      0x0001
+#define ZIP64_SATURATED     0xFFFFFFFF
+/* Each benchmark runs BENCH_ROUNDS rounds of at least BENCH_ROUND_TIME ns, and keeps the best */
+#define BENCH_ROUNDS        5
+#define BENCH_ROUND_TIME    200000000ULL
+/* Deflate window of the XLSX members and of the puff() benchmark data */
+#define DEFLATE_WINDOW      32768
+
+typedef struct {
+    size_t count;               /* number of licenses */
+    double duplicates;          /* ratio of licenses that repeat an earlier one */
+    double psm;                 /* ratio of PSM licenses */
+    double corrupt;             /* ratio of zRIFs with a damaged character */
+    uint32_t seed;
+    size_t tsv_size;            /* minimum size of the TSV feed, in MB */
+    const char* dir;
+    const char* json;
+    bool check;                 /* only run the self-checks */
+} bench_config;
+
+typedef struct {
+    char** zrif;
+    size_t count;
+    size_t bytes;
+} corpus;
+
+typedef struct {
+    const char* name;
+    double ops_per_s;
+    double mb_per_s;
+} bench_result;
+
+typedef struct {
+    uint8_t data[1024];
+    size_t len;
+} rif_sample;
+
+/* Context of the benchmarks, which return the number of bytes they processed */
+typedef struct {
+    const corpus* zrifs;
+    const rif_sample* rifs;
+    size_t nb_rifs;
+    const uint8_t* text;
+    size_t text_len;
+    const uint8_t* deflated;
+    size_t deflated_len;
+    const uint8_t* xlsx;
+    size_t xlsx_len;
+    const char* tsv;
+    size_t tsv_len;
+    uint8_t* out;
+    size_t out_len;
+} bench_context;
+
+typedef struct {
+    xml_parser xml;
+    size_t bytes;
+} xml_text_count;
+
+typedef size_t (*bench_func)(bench_context* ctx);
+
+static bench_result results[MAX_BENCHMARKS];
+static size_t nb_results;
+
+/* xorshift32, so that the feeds are the same on every platform */
+static uint32_t rnd(uint32_t* state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static bool chance(uint32_t* state, double ratio)
+{
+    return (rnd(state) % 1000000) < (uint32_t)(ratio * 1000000.0);
+}
+
+static void setle16(uint8_t* p, uint16_t val)
+{
+    p[0] = (uint8_t)val;
+    p[1] = (uint8_t)(val >> 8);
+}
+
+static void setle32(uint8_t* p, uint32_t val)
+{
+    setle16(p, (uint16_t)val);
+    setle16(&p[2], (uint16_t)(val >> 16));
+}
+
+static void setle64(uint8_t* p, uint64_t val)
+{
+    setle32(p, (uint32_t)val);
+    setle32(&p[4], (uint32_t)(val >> 32));
+}
+
+/* Same layout as the licenses NoNpDrm creates, with a pseudo random key */
+static void make_rif(uint8_t* rif, size_t rif_len, size_t index, uint32_t* state)
+{
+    char content_id[RIF_CONTENT_ID_MAX];
+
+    memset(rif, 0, rif_len);
+    snprintf(content_id, sizeof(content_id), "UP%04d-PCSE%05d_00-%016d",
+        (int)(index % 10000), (int)(index % 100000), (int)index);
+    if (rif_len == 512) {
+        static const uint8_t magic[8] = { 0, 1, 0, 1, 0, 1, 0, 2 };
+        memcpy(rif, magic, sizeof(magic));
+    }
+    memcpy((char*)rif_content_id(rif), content_id, strlen(content_id));
+    for (size_t i = 0x100; i < 0x140; i++)
+        rif[i] = (uint8_t)rnd(state);
+}
+
+static bool make_corpus(const bench_config* cfg, corpus* c)
+{
+    static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    uint8_t rif[1024];
+    char zrif[MAX_ZRIF_LENGTH];
+    uint32_t state = cfg->seed;
+    size_t i, len;
+
+    c->zrif = calloc(cfg->count, sizeof(char*));
+    c->count = 0;
+    c->bytes = 0;
+    if (c->zrif == NULL)
+        return false;
+    for (i = 0; i < cfg->count; i++) {
+        if ((i != 0) && chance(&state, cfg->duplicates)) {
+            const char* dup = c->zrif[rnd(&state) % i];
+            len = strlen(dup);
+            memcpy(zrif, dup, len + 1);
+        } else {
+            size_t rif_len = chance(&state, cfg->psm) ? 1024 : 512;
+            make_rif(rif, rif_len, i, &state);
+            len = encode_zrif(rif, rif_len, zrif, sizeof(zrif));
+            if (len == 0)
+                return false;
+        }
+        /* Damage a character after the "KO5i" marker, so that the zRIF is still picked up */
+        if (chance(&state, cfg->corrupt)) {
+            size_t pos = 4 + rnd(&state) % (len - 4);
+            zrif[pos] = b64[(strchr(b64, zrif[pos]) - b64 + 1 + rnd(&state) % 63) % 64];
+        }
+        c->zrif[i] = malloc(len + 1);
+        if (c->zrif[i] == NULL)
+            return false;
+        memcpy(c->zrif[i], zrif, len + 1);
+        c->bytes += len;
+        c->count++;
+    }
+    return true;
+}
+
+static void free_corpus(corpus* c)
+{
+    for (size_t i = 0; i < c->count; i++)
+        free(c->zrif[i]);
+    free(c->zrif);
+}
+
+/*
+ * Build regular and PSM RIFs, in turn, for the encode_zrif() check and benchmark,
+ * with every other one of each kind also holding random data after its key, which
+ * doesn't compress at all.
+ */
+static rif_sample* make_rif_samples(uint32_t seed, size_t count)
+{
+    rif_sample* rifs = malloc(count * sizeof(rif_sample));
+    uint32_t state = seed;
+
+    if (rifs == NULL)
+        return NULL;
+    for (size_t i = 0; i < count; i++) {
+        rifs[i].len = (i % 2 == 0) ? 512 : 1024;
+        make_rif(rifs[i].data, rifs[i].len, i, &state);
+        if (i % 4 >= 2) {
+            for (size_t j = 0x140; j < rifs[i].len; j++)
+                rifs[i].data[j] = (uint8_t)rnd(&state);
+        }
+    }
+    return rifs;
+}
+
+/* Every zRIF that encode_zrif() produces must pass check_zrif() and decode back to the very same RIF */
+static bool check_encode_zrif(const rif_sample* rifs, size_t count)
+{
+    uint8_t rif[1024];
+    char zrif[MAX_ZRIF_LENGTH];
+    int r;
+
+    for (size_t i = 0; i < count; i++) {
+        if (encode_zrif(rifs[i].data, rifs[i].len, zrif, sizeof(zrif)) == 0) {
+            fprintf(stderr, "Cannot encode RIF #%d (%d bytes)\n", (int)i, (int)rifs[i].len);
+            return false;
+        }
+        r = check_zrif(zrif);
+        if (r != ZRIF_OK) {
+            fprintf(stderr, "zRIF #%d (%d bytes) is invalid: %s\n", (int)i, (int)rifs[i].len, zrif_strerror(r));
+            return false;
+        }
+        if ((decode_zrif(zrif, rif, sizeof(rif)) != rifs[i].len) || (memcmp(rif, rifs[i].data, rifs[i].len) != 0)) {
+            fprintf(stderr, "zRIF #%d (%d bytes) doesn't decode back to its RIF\n", (int)i, (int)rifs[i].len);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* A stored block, followed by the dynamic block zlib makes of a dozen lines of CSV at level 9 */
+static const uint8_t stored_dynamic_blocks[] = {
+    0x00, 0x05, 0x00, 0xfa, 0xff, 'T', 'i', 't', 'l', 'e',
+    0x6d, 0xd0, 0xb1, 0x0e, 0x83, 0x20, 0x14, 0x46, 0xe1, 0xbd, 0x4f, 0xd1, 0x07, 0x60, 0xe0, 0x2a,
+    0xa0, 0x8e, 0x84, 0x10, 0x06, 0x07, 0x69, 0x4d, 0x1f, 0x40, 0x82, 0x84, 0x0e, 0x7d, 0xff, 0xb5,
+    0x31, 0x31, 0xff, 0xd5, 0x84, 0x33, 0x7f, 0xd3, 0x89, 0x6e, 0xf5, 0xf2, 0x48, 0x7c, 0x56, 0x11,
+    0xb6, 0xdf, 0xfe, 0x94, 0x62, 0x5e, 0xf4, 0xb7, 0xbc, 0x29, 0xbf, 0xac, 0xb5, 0x8f, 0x78, 0x02,
+    0x02, 0x20, 0x06, 0x29, 0x25, 0x80, 0x0e, 0xa0, 0x63, 0xe0, 0x9c, 0x03, 0xe8, 0x01, 0x7a, 0x06,
+    0x39, 0x67, 0x00, 0x05, 0xa0, 0x18, 0x78, 0xef, 0x01, 0x34, 0x80, 0x66, 0x50, 0x4a, 0x01, 0x30,
+    0x00, 0x86, 0x41, 0x08, 0x01, 0x60, 0x00, 0x18, 0x18, 0xd4, 0x5a, 0x01, 0x46, 0x80, 0xb1, 0xfd,
+    0x61, 0x02, 0x98, 0x9a, 0x1f, 0x88, 0x4f, 0x92, 0x6c, 0x8e, 0xa0, 0xcb, 0x4a, 0xba, 0x9f, 0xf8,
+    0x03 };
+#define STORED_DYNAMIC_SIZE (5 + 398)
+
+/*
+ * Inflate the same data with puff() and with puff_padded(), the latter with its
+ * padding zeroed, set or holding a copy of the data, and check that both return
+ * the same, and that, unless they run out of input or output space, they also
+ * consume and produce the same. out_len includes the dictionary.
+ */
+static bool compare_puff(const char* name, const uint8_t* dict, size_t dictlen, const uint8_t* in, size_t in_len,
+    size_t out_len)
+{
+    uint8_t *padded = malloc(in_len + PUFF_PAD), *out[2];
+    size_t dest_len[2], source_len[2];
+    int r[2];
+    bool ok = false;
+
+    out[0] = malloc(out_len);
+    out[1] = malloc(out_len);
+    if ((padded == NULL) || (out[0] == NULL) || (out[1] == NULL)) {
+        fprintf(stderr, "Cannot allocate buffer\n");
+        goto out;
+    }
+    memcpy(padded, in, in_len);
+    memset(out[0], 0xaa, out_len);
+    memcpy(out[0], dict, dictlen);
+    dest_len[0] = out_len;
+    source_len[0] = in_len;
+    r[0] = puff(dictlen, out[0], &dest_len[0], in, &source_len[0]);
+    for (int pad = 0; pad < 3; pad++) {
+        for (size_t i = 0; i < PUFF_PAD; i++)
+            padded[in_len + i] = (pad == 0) ? 0x00 : ((pad == 1) ? 0xff : ((in_len > 0) ? in[i % in_len] : 0x5a));
+        memset(out[1], 0xaa, out_len);
+        memcpy(out[1], dict, dictlen);
+        dest_len[1] = out_len;
+        source_len[1] = in_len;
+        r[1] = puff_padded(dictlen, out[1], &dest_len[1], padded, &source_len[1]);
+        if ((r[0] != r[1]) || ((r[0] <= 0) && ((dest_len[0] != dest_len[1]) || (source_len[0] != source_len[1]) ||
+            (memcmp(out[0], out[1], dictlen + dest_len[0]) != 0)))) {
+            fprintf(stderr, "puff() and puff_padded() disagree on %s (%d bytes): %d and %d\n",
+                name, (int)in_len, r[0], r[1]);
+            goto out;
+        }
+    }
+    ok = true;
+
+out:
+    free(padded);
+    free(out[0]);
+    free(out[1]);
+    return ok;
+}
+
+/*
+ * Compare puff() and puff_padded() on a stream, on its truncations and with one
+ * of its bytes damaged, for every step bytes as well as for its last bytes, and
+ * with enough output space, just enough, or too little.
+ */
+static bool compare_puff_damaged(const char* name, const uint8_t* dict, size_t dictlen, const uint8_t* in,
+    size_t in_len, size_t data_len, size_t step)
+{
+    static const uint8_t flips[4] = { 0x01, 0x08, 0x40, 0xff };
+    uint8_t* damaged = malloc(in_len);
+    size_t out_len = dictlen + data_len + PUFF_SLACK;
+    bool ok = (damaged != NULL);
+
+    ok = ok && compare_puff(name, dict, dictlen, in, in_len, dictlen + data_len);
+    ok = ok && compare_puff(name, dict, dictlen, in, in_len, dictlen + data_len - 1);
+    if (ok)
+        memcpy(damaged, in, in_len);
+    for (size_t i = 0; ok && (i < in_len); i++) {
+        if ((i % step != 0) && (in_len - i > 64))
+            continue;
+        ok = compare_puff(name, dict, dictlen, in, i, out_len);
+        for (int f = 0; ok && (f < 4); f++) {
+            damaged[i] ^= flips[f];
+            ok = compare_puff(name, dict, dictlen, damaged, in_len, out_len);
+            damaged[i] ^= flips[f];
+        }
+    }
+    free(damaged);
+    return ok;
+}
+
+/*
+ * puff_padded(), which the zRIF decoder uses, must give the same results as
+ * puff() on zRIF style streams with a dictionary, on stored and dynamic blocks,
+ * on feeds with matches up to 32 KB back, and on all of their damaged copies.
+ */
+static bool check_puff_padded(const rif_sample* rifs, size_t nb_rifs, const char* text, size_t text_len)
+{
+    uint8_t buf[2048], stream[2048], *deflated;
+    size_t len, i;
+    bool ok = true;
+
+    for (i = 1; ok && (i < nb_rifs) && (i < 8); i++) {
+        memcpy(buf, rifs[0].data, rifs[0].len);
+        memcpy(&buf[rifs[0].len], rifs[i].data, rifs[i].len);
+        len = deflate_fixed(buf, rifs[0].len, rifs[i].len, 1024, stream, sizeof(stream));
+        ok = (len != 0) && (len <= sizeof(stream)) &&
+            compare_puff_damaged("a zRIF stream", rifs[0].data, rifs[0].len, stream, len, rifs[i].len, 1);
+    }
+    ok = ok && compare_puff_damaged("stored and dynamic blocks", buf, 0, stored_dynamic_blocks,
+        sizeof(stored_dynamic_blocks), STORED_DYNAMIC_SIZE, 1);
+
+    if (text_len > 64 * 1024)
+        text_len = 64 * 1024;
+    deflated = malloc(text_len + text_len / 8 + 16);
+    if (deflated == NULL)
+        return false;
+    len = deflate_fixed((const uint8_t*)text, 0, text_len, DEFLATE_WINDOW, deflated, text_len + text_len / 8 + 16);
+    ok = ok && (len != 0) && compare_puff_damaged("the CSV feed", buf, 0, deflated, len, text_len, 1021);
+    free(deflated);
+    return ok;
+}
+
+/* Build one of the feed formats in memory, with room for a terminating NUL */
+static char* make_feed(const corpus* c, const char* format, size_t first, size_t last, size_t* size)
+{
+    size_t i, pos = 0, max = c->bytes + 128 * (last - first) + 256;
+    char* buf = malloc(max);
+
+    if (buf == NULL)
+        return NULL;
+    if (strcmp(format, "csv") == 0) {
+        pos += sprintf(&buf[pos], "Title ID,Region,Name,zRIF\n");
+        for (i = first; i < last; i++)
+            pos += sprintf(&buf[pos], "PCSE%05d,US,Game %d,%s\n", (int)(i % 100000), (int)i, c->zrif[i]);
+    } else if (strcmp(format, "xml") == 0) {
+        pos += sprintf(&buf[pos], "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<licenses>\n");
+        for (i = first; i < last; i++)
+            pos += sprintf(&buf[pos], "  <license title=\"PCSE%05d\">%s</license>\n", (int)(i % 100000), c->zrif[i]);
+        pos += sprintf(&buf[pos], "</licenses>\n");
+    } else if (strcmp(format, "sst") == 0) {
+        pos += sprintf(&buf[pos], "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n<sst count=\"%d\">",
+            (int)(last - first));
+        for (i = first; i < last; i++)
+            pos += sprintf(&buf[pos], "<si><t>%s</t></si>", c->zrif[i]);
+        pos += sprintf(&buf[pos], "</sst>");
+    } else {
+        pos += sprintf(&buf[pos], "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n<worksheet><sheetData>");
+        for (i = first; i < last; i++)
+            pos += sprintf(&buf[pos], "<row r=\"%d\"><c r=\"D%d\" t=\"inlineStr\"><is><t>%s</t></is></c></row>",
+                (int)(i - first + 1), (int)(i - first + 1), c->zrif[i]);
+        pos += sprintf(&buf[pos], "</sheetData></worksheet>");
+    }
+    *size = pos;
+    return buf;
+}
+
+/*
+ * Build a NoPayStation style TSV of at least min_size bytes, going through the
+ * licenses as many times as needed, where the zRIF is one of many wide columns.
+ */
+static char* make_tsv(const corpus* c, size_t min_size, uint32_t seed, size_t* size)
+{
+    static const char* regions[4] = { "US", "EU", "JP", "ASIA" };
+    static const char hex[] = "0123456789ABCDEF";
+    uint32_t state = seed;
+    size_t i, pos = 0;
+    char sha256[65];
+    char* buf = malloc(min_size + 4 * MAX_ZRIF_LENGTH);
+
+    if (buf == NULL)
+        return NULL;
+    pos += sprintf(&buf[pos], "Title ID\tRegion\tName\tPKG direct link\tzRIF\tContent ID\tLast Modification Date\t"
+        "Original Name\tFile Size\tSHA256\tRequired FW\tApp Version\n");
+    for (i = 0; pos < min_size; i++) {
+        int id = (int)(i % 100000);
+        for (size_t j = 0; j < sizeof(sha256) - 1; j++)
+            sha256[j] = hex[rnd(&state) % 16];
+        sha256[sizeof(sha256) - 1] = 0;
+        pos += sprintf(&buf[pos], "PCSE%05d\t%s\tGame %d: Knights of the Remastered Kingdom\t"
+            "http://zeus.dl.playstation.net/cdn/UP%04d/PCSE%05d_00/%08x%08x.pkg\t%s\tUP%04d-PCSE%05d_00-%016d\t"
+            "2018-%02d-%02d 12:00:00\tGame %d\t%u\t%s\t3.60\t01.00\n",
+            id, regions[i % 4], (int)i, id % 10000, id, rnd(&state), rnd(&state), c->zrif[i % c->count],
+            id % 10000, id, (int)i, (int)(1 + i % 12), (int)(1 + i % 28), (int)i, rnd(&state) % 4000000000U, sha256);
+    }
+    *size = pos;
+    return buf;
+}
+
+/*
+ * Build an XLSX with the first half of the licenses as shared strings and the
+ * second half as inline strings, with every member deflated.
+ */
+static uint8_t* make_xlsx(const corpus* c, size_t* size)
+{
+    const char* names[3] = { "[Content_Types].xml", "xl/sharedStrings.xml", "xl/worksheets/sheet1.xml" };
+    char* data[3] = { NULL, NULL, NULL };
+    size_t data_len[3], offset[3], i, max = 22, pos = 0;
+    uint32_t crc[3];
+    uint8_t* zip = NULL;
+    static char content_types[] = "<?xml version=\"1.0\" encoding=\"UTF-8\"?><Types/>";
+
+    data[0] = malloc(sizeof(content_types));
+    if (data[0] != NULL)
+        memcpy(data[0], content_types, sizeof(content_types));
+    data_len[0] = sizeof(content_types) - 1;
+    data[1] = make_feed(c, "sst", 0, c->count / 2, &data_len[1]);
+    data[2] = make_feed(c, "sheet", c->count / 2, c->count, &data_len[2]);
+    for (i = 0; i < 3; i++) {
+        if (data[i] == NULL)
+            goto out;
+        max += 30 + 46 + 2 * strlen(names[i]) + data_len[i] + data_len[i] / 8 + 16;
+    }
+    zip = malloc(max);
+    if (zip == NULL)
+        goto out;
+
+    for (i = 0; i < 3; i++) {
+        uint8_t* lh = &zip[pos];
+        size_t name_len = strlen(names[i]), compressed;
+        offset[i] = pos;
+        crc[i] = zip_crc32(0, (uint8_t*)data[i], data_len[i]);
+        compressed = deflate_fixed((uint8_t*)data[i], 0, data_len[i], DEFLATE_WINDOW, &lh[30 + name_len],
+            data_len[i] + data_len[i] / 8 + 16);
+        if ((compressed == 0) || (compressed > data_len[i] + data_len[i] / 8 + 16)) {
+            free(zip);
+            zip = NULL;
+            goto out;
+        }
+        memset(lh, 0, 30);
+        setle32(lh, 0x04034b50);
+        setle16(&lh[4], 20);
+        setle16(&lh[8], 8);
+        setle32(&lh[14], crc[i]);
+        setle32(&lh[18], (uint32_t)compressed);
+        setle32(&lh[22], (uint32_t)data_len[i]);
+        setle16(&lh[26], (uint16_t)name_len);
+        memcpy(&lh[30], names[i], name_len);
+        pos += 30 + name_len + compressed;
+    }
+    size_t cd_offset = pos;
+    for (i = 0; i < 3; i++) {
+        uint8_t* cd = &zip[pos];
+        const uint8_t* lh = &zip[offset[i]];
+        size_t name_len = strlen(names[i]);
+        memset(cd, 0, 46);
+        setle32(cd, 0x02014b50);
+        setle16(&cd[4], 20);
+        memcpy(&cd[6], &lh[4], 26);
+        setle32(&cd[42], (uint32_t)offset[i]);
+        memcpy(&cd[46], names[i], name_len);
+        pos += 46 + name_len;
+    }
+    memset(&zip[pos], 0, 22);
+    setle32(&zip[pos], 0x06054b50);
+    setle16(&zip[pos + 8], 3);
+    setle16(&zip[pos + 10], 3);
+    setle32(&zip[pos + 12], (uint32_t)(pos - cd_offset));
+    setle32(&zip[pos + 16], (uint32_t)cd_offset);
+    pos += 22;
+    *size = pos;
+
+out:
+    for (i = 0; i < 3; i++)
+        free(data[i]);
+    return zip;
+}
+
+static bool write_file(const char* dir, const char* name, const void* data, size_t size)
+{
+    char path[512];
+    FILE* fd;
+    bool r;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    fd = fopen(path, "wb");
+    if (fd == NULL) {
+        fprintf(stderr, "Cannot create '%s'\n", path);
+        return false;
+    }
+    r = (fwrite(data, 1, size, fd) == size);
+    fclose(fd);
+    if (!r)
+        fprintf(stderr, "Cannot write '%s'\n", path);
+    return r;
+}
+
+/*
+ * Write the licenses as a license/app/<TITLE_ID>/<CONTENT_ID>.rif tree, as
+ * NoNpDrm lays them out. Corrupted zRIFs can't be decoded, so they are left out,
+ * and duplicates overwrite the earlier file.
+ */
+static bool make_rif_tree(const corpus* c, const char* dir, const char* name, size_t* nb_files)
+{
+    uint8_t rif[1024];
+    char path[512], title_id[10];
+    const char* content_id;
+    size_t rif_len;
+
+    *nb_files = 0;
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/%s/app", dir, name);
+    mkdir(path, 0755);
+    for (size_t i = 0; i < c->count; i++) {
+        rif_len = decode_zrif(c->zrif[i], rif, sizeof(rif));
+        if (rif_len == 0)
+            continue;
+        content_id = rif_content_id(rif);
+        memcpy(title_id, &content_id[7], 9);
+        title_id[9] = 0;
+        snprintf(path, sizeof(path), "%s/%s/app/%s", dir, name, title_id);
+        mkdir(path, 0755);
+        snprintf(path, sizeof(path), "%s/app/%s/%s.rif", name, title_id, content_id);
+        if (!write_file(dir, path, rif, rif_len))
+            return false;
+        (*nb_files)++;
+    }
+    return true;
+}
+
+/* Same search as vitali's scan_zrifs(), which looks at every byte for a "KO5i" marker */
+static size_t count_zrifs_memchr(const char* buf, size_t size)
+{
+    const char *p = buf, *end = buf + size;
+    size_t found = 0;
+
+    while ((p < end) && ((p = memchr(p, 'K', end - p)) != NULL)) {
+        if ((end - p < 4) || (memcmp(p, "KO5i", 4) != 0)) {
+            p++;
+            continue;
+        }
+        p = zrif_span(p, end);
+        found++;
+    }
+    return found;
+}
+
+/* Same search as vitali's scan_csv_zrifs(), which only looks at the zRIF column */
+static size_t count_zrifs_csv(const char* buf, size_t size)
+{
+    const char *p = buf, *end = buf + size, *start;
+    size_t found = 0;
+    csv_parser csv;
+
+    if (!csv_init(&csv, buf, size, "zRIF"))
+        return 0;
+    while ((p = csv_next_field(&csv, p, end)) != NULL) {
+        start = p;
+        p = zrif_span(p, end);
+        if ((p - start >= 4) && (memcmp(start, "KO5i", 4) == 0))
+            found++;
+    }
+    return found;
+}
+
+static size_t bench_scan_memchr(bench_context* ctx)
+{
+    volatile size_t found = count_zrifs_memchr(ctx->tsv, ctx->tsv_len);
+    (void)found;
+    return ctx->tsv_len;
+}
+
+static size_t bench_scan_csv(bench_context* ctx)
+{
+    volatile size_t found = count_zrifs_csv(ctx->tsv, ctx->tsv_len);
+    (void)found;
+    return ctx->tsv_len;
+}
+
+static size_t bench_decode_zrif(bench_context* ctx)
+{
+    uint8_t rif[1024];
+    size_t i, bytes = 0;
+
+    for (i = 0; i < ctx->zrifs->count; i++) {
+        decode_zrif(ctx->zrifs->zrif[i], rif, sizeof(rif));
+        bytes += strlen(ctx->zrifs->zrif[i]);
+    }
+    return bytes;
+}
+
+static size_t bench_encode_zrif(bench_context* ctx)
+{
+    char zrif[MAX_ZRIF_LENGTH];
+    size_t i, bytes = 0;
+
+    for (i = 0; i < ctx->nb_rifs; i++) {
+        encode_zrif(ctx->rifs[i].data, ctx->rifs[i].len, zrif, sizeof(zrif));
+        bytes += ctx->rifs[i].len;
+    }
+    return bytes;
+}
+
+static size_t bench_base64_decode(bench_context* ctx)
+{
+    uint8_t raw[MAX_ZRIF_LENGTH];
+    size_t i, bytes = 0;
+
+    for (i = 0; i < ctx->zrifs->count; i++) {
+        base64_decode(ctx->zrifs->zrif[i], raw);
+        bytes += strlen(ctx->zrifs->zrif[i]);
+    }
+    return bytes;
+}
+
+static size_t bench_puff(bench_context* ctx)
+{
+    size_t dest_len = ctx->out_len, source_len = ctx->deflated_len;
+
+    if (puff(0, ctx->out, &dest_len, ctx->deflated, &source_len) != 0)
+        return 0;
+    return dest_len;
+}
+
+static size_t bench_adler32(bench_context* ctx)
+{
+    volatile uint32_t sum = zip_adler32(1, ctx->text, ctx->text_len);
+    (void)sum;
+    return ctx->text_len;
+}
+
+static size_t bench_crc32(bench_context* ctx)
+{
+    volatile uint32_t sum = zip_crc32(0, ctx->text, ctx->text_len);
+    (void)sum;
+    return ctx->text_len;
+}
+
+static bool is_xlsx_text_member(const char* name, size_t name_len)
+{
+    return (name_len > 3) && (strncmp(name, "xl/", 3) == 0);
+}
+
+/* Hand the text of the cells over to a consumer, counting it */
+static int count_xml_text(void* opaque, const uint8_t* data, size_t len)
+{
+    xml_text_count* count = (xml_text_count*)opaque;
+    const char *p = (const char*)data, *end = p + len, *text;
+    size_t text_len;
+
+    while ((text = xml_next_text(&count->xml, &p, end, &text_len)) != NULL)
+        count->bytes += text_len;
+    return 0;
+}
+
+static void count_xml_done(const zip_member* member, void* opaque)
+{
+    xml_text_count* count = (xml_text_count*)opaque;
+
+    (void)member;
+    xml_init(&count->xml);
+}
+
+static size_t unzip_xlsx(bench_context* ctx, size_t max_workers)
+{
+    zip_member members[8];
+    xml_text_count count;
+    size_t i, bytes = 0;
+    int nb_members = zip_list(ctx->xlsx, ctx->xlsx_len, is_xlsx_text_member, members, 8);
+
+    if (nb_members <= 0)
+        return 0;
+    xml_init(&count.xml);
+    count.bytes = 0;
+    if (zip_stream_members(members, (size_t)nb_members, max_workers, count_xml_text, count_xml_done, &count) != (size_t)nb_members)
+        return 0;
+    for (i = 0; i < (size_t)nb_members; i++)
+        bytes += members[i].uncompressed_size;
+    return bytes;
+}
+
+/* Same extraction as vitali's scan_source() for XLSX files, with members streamed through the XML tokenizer */
+static size_t bench_unzip(bench_context* ctx)
+{
+    return unzip_xlsx(ctx, 0);
+}
+
+/* The same, with the members inflated one after the other by the calling thread */
+static size_t bench_unzip_serial(bench_context* ctx)
+{
+    return unzip_xlsx(ctx, 1);
+}
+
+#if !defined(_WIN32)
+/* Write all of buf at offset, leaving any gap before it as a hole in the file */
+static bool write_at(int fd, const void* buf, size_t len, uint64_t offset)
+{
+    const uint8_t* p = (const uint8_t*)buf;
+    ssize_t n;
+
+    while (len > 0) {
+        n = pwrite(fd, p, len, (off_t)offset);
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return true;
+}
+
+/*
+ * Write a sparse XLSX of more than 4 GB, where a stored member of ZIP64_HOLE_SIZE
+ * zeros comes before the shared strings with all the licenses, so that the sizes
+ * of the first member, the offset of the second, and the central directory can
+ * only be found through the ZIP64 extensions.
+ */
+static bool make_zip64_xlsx(const corpus* c, const char* path)
+{
+    const char* names[2] = { "xl/media/image1.bin", "xl/sharedStrings.xml" };
+    uint8_t *zeros = calloc(1, ZIP_STREAM_WINDOW), *sst_deflated = NULL, rec[256];
+    char* sst = NULL;
+    size_t sst_len = 0, sst_deflated_len = 0, name_len[2], len;
+    uint64_t offset[2], pos, cd_offset, eocd64_offset;
+    uint32_t crc[2] = { 0, 0 };
+    bool r = false;
+    int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+
+    if ((fd < 0) || (zeros == NULL))
+        goto out;
+    sst = make_feed(c, "sst", 0, c->count, &sst_len);
+    sst_deflated = (sst == NULL) ? NULL : malloc(sst_len + sst_len / 8 + 16);
+    if (sst_deflated == NULL)
+        goto out;
+    sst_deflated_len = deflate_fixed((uint8_t*)sst, 0, sst_len, DEFLATE_WINDOW, sst_deflated, sst_len + sst_len / 8 + 16);
+    if ((sst_deflated_len == 0) || (sst_deflated_len > sst_len + sst_len / 8 + 16))
+        goto out;
+    for (pos = 0; pos < ZIP64_HOLE_SIZE; pos += ZIP_STREAM_WINDOW)
+        crc[0] = zip_crc32(crc[0], zeros, ZIP_STREAM_WINDOW);
+    crc[1] = zip_crc32(0, (uint8_t*)sst, sst_len);
+    name_len[0] = strlen(names[0]);
+    name_len[1] = strlen(names[1]);
+
+    /* Stored member, with its sizes in the ZIP64 extra field of the local header */
+    memset(rec, 0, 30);
+    setle32(rec, 0x04034b50);
+    setle16(&rec[4], 45);
+    setle32(&rec[14], crc[0]);
+    setle32(&rec[18], ZIP64_SATURATED);
+    setle32(&rec[22], ZIP64_SATURATED);
+    setle16(&rec[26], (uint16_t)name_len[0]);
+    setle16(&rec[28], 20);
+    memcpy(&rec[30], names[0], name_len[0]);
+    len = 30 + name_len[0];
+    setle16(&rec[len], ZIP64_EXTRA_ID);
+    setle16(&rec[len + 2], 16);
+    setle64(&rec[len + 4], ZIP64_HOLE_SIZE);
+    setle64(&rec[len + 12], ZIP64_HOLE_SIZE);
+    len += 20;
+    offset[0] = 0;
+    if (!write_at(fd, rec, len, offset[0]))
+        goto out;
+
+    /* Deflated shared strings, past 4 GB */
+    offset[1] = len + ZIP64_HOLE_SIZE;
+    memset(rec, 0, 30);
+    setle32(rec, 0x04034b50);
+    setle16(&rec[4], 20);
+    setle16(&rec[8], 8);
+    setle32(&rec[14], crc[1]);
+    setle32(&rec[18], (uint32_t)sst_deflated_len);
+    setle32(&rec[22], (uint32_t)sst_len);
+    setle16(&rec[26], (uint16_t)name_len[1]);
+    memcpy(&rec[30], names[1], name_len[1]);
+    len = 30 + name_len[1];
+    if (!write_at(fd, rec, len, offset[1]) || !write_at(fd, sst_deflated, sst_deflated_len, offset[1] + len))
+        goto out;
+
+    /* Central directory, with the saturated sizes of the first member and offset of the second in ZIP64 extras */
+    cd_offset = offset[1] + len + sst_deflated_len;
+    pos = cd_offset;
+    for (int i = 0; i < 2; i++) {
+        memset(rec, 0, 46);
+        setle32(rec, 0x02014b50);
+        setle16(&rec[4], 45);
+        setle16(&rec[6], 45);
+        setle16(&rec[10], (i == 0) ? 0 : 8);
+        setle32(&rec[16], crc[i]);
+        setle32(&rec[20], (i == 0) ? ZIP64_SATURATED : (uint32_t)sst_deflated_len);
+        setle32(&rec[24], (i == 0) ? ZIP64_SATURATED : (uint32_t)sst_len);
+        setle16(&rec[28], (uint16_t)name_len[i]);
+        setle16(&rec[30], (i == 0) ? 20 : 12);
+        setle32(&rec[42], (i == 0) ? (uint32_t)offset[0] : ZIP64_SATURATED);
+        memcpy(&rec[46], names[i], name_len[i]);
+        len = 46 + name_len[i];
+        setle16(&rec[len], ZIP64_EXTRA_ID);
+        if (i == 0) {
+            setle16(&rec[len + 2], 16);
+            setle64(&rec[len + 4], ZIP64_HOLE_SIZE);
+            setle64(&rec[len + 12], ZIP64_HOLE_SIZE);
+            len += 20;
+        } else {
+            setle16(&rec[len + 2], 8);
+            setle64(&rec[len + 4], offset[1]);
+            len += 12;
+        }
+        if (!write_at(fd, rec, len, pos))
+            goto out;
+        pos += len;
+    }
+
+    /* ZIP64 end of central directory record and locator, followed by an EOCD that defers to them */
+    eocd64_offset = pos;
+    memset(rec, 0, 56 + 20 + 22);
+    setle32(rec, 0x06064b50);
+    setle64(&rec[4], 56 - 12);
+    setle16(&rec[12], 45);
+    setle16(&rec[14], 45);
+    setle64(&rec[24], 2);
+    setle64(&rec[32], 2);
+    setle64(&rec[40], eocd64_offset - cd_offset);
+    setle64(&rec[48], cd_offset);
+    setle32(&rec[56], 0x07064b50);
+    setle64(&rec[56 + 8], eocd64_offset);
+    setle32(&rec[56 + 16], 1);
+    setle32(&rec[76], 0x06054b50);
+    setle16(&rec[76 + 8], 2);
+    setle16(&rec[76 + 10], 2);
+    setle32(&rec[76 + 12], (uint32_t)(eocd64_offset - cd_offset));
+    setle32(&rec[76 + 16], ZIP64_SATURATED);
+    r = write_at(fd, rec, 56 + 20 + 22, eocd64_offset);
+
+out:
+    if (!r)
+        fprintf(stderr, "Cannot write '%s'\n", path);
+    if (fd >= 0)
+        close(fd);
+    free(zeros);
+    free(sst);
+    free(sst_deflated);
+    return r;
+}
+#endif
+
+/*
+ * List and extract the members of a ZIP64 archive over 4 GB, mapped in memory
+ * the same way as vitali reads it, which requires a 64-bit address space.
+ */
+static bool check_zip64(const corpus* c, const char* dir)
+{
+#if defined(_WIN32) || (SIZE_MAX <= 0xFFFFFFFF)
+    (void)c;
+    (void)dir;
+    printf("Skipping the ZIP64 check, which needs mmap() and a 64-bit address space\n");
+    return true;
+#else
+    char path[512];
+    zip_member members[4];
+    xml_text_count count;
+    struct stat st;
+    size_t i, bytes = 0;
+    uint8_t* map = MAP_FAILED;
+    bool r = false;
+    int fd = -1, nb_members;
+
+    snprintf(path, sizeof(path), "%s/zip64.xlsx", dir);
+    if (!make_zip64_xlsx(c, path))
+        goto out;
+    fd = open(path, O_RDONLY);
+    if ((fd < 0) || (fstat(fd, &st) != 0)) {
+        fprintf(stderr, "Cannot open '%s'\n", path);
+        goto out;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Cannot map '%s'\n", path);
+        goto out;
+    }
+    nb_members = zip_list(map, (size_t)st.st_size, NULL, members, 4);
+    if ((nb_members != 2) || (members[0].method != 0) || (members[0].uncompressed_size != ZIP64_HOLE_SIZE) ||
+        (members[0].compressed_size != ZIP64_HOLE_SIZE) || (members[1].data - map <= (ptrdiff_t)ZIP64_HOLE_SIZE)) {
+        fprintf(stderr, "The members of the ZIP64 archive were not listed as expected\n");
+        goto out;
+    }
+    /* The text of each cell is followed by a '\n' */
+    for (i = 0; i < c->count; i++)
+        bytes += strlen(c->zrif[i]) + 1;
+    xml_init(&count.xml);
+    count.bytes = 0;
+    members[1].err = zip_stream_member(&members[1], count_xml_text, &count);
+    if ((members[1].err != 0) || (count.bytes != bytes)) {
+        fprintf(stderr, "Could not extract the licenses from the ZIP64 archive (error %d)\n", members[1].err);
+        goto out;
+    }
+    printf("Listed and extracted a %.1f GB ZIP64 archive (%.1f MB on disk)\n",
+        st.st_size / (1024.0 * 1024.0 * 1024.0), st.st_blocks * 512.0 / (1024.0 * 1024.0));
+    r = true;
+
+out:
+    if (map != MAP_FAILED)
+        munmap(map, (size_t)st.st_size);
+    if (fd >= 0)
+        close(fd);
+    remove(path);
+    return r;
+#endif
+}
+
+static void run_bench(const char* name, bench_func func, bench_context* ctx, size_t ops_per_call)
+{
+    bench_result* r = &results[nb_results++];
+    uint64_t start, elapsed, calls, bytes;
+
+    r->name = name;
+    r->ops_per_s = 0.0;
+    r->mb_per_s = 0.0;
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        calls = 0;
+        bytes = 0;
+        start = stats_clock();
+        do {
+            bytes += func(ctx);
+            calls++;
+            elapsed = stats_clock() - start;
+        } while (elapsed < BENCH_ROUND_TIME);
+        if (calls * ops_per_call * 1e9 / elapsed > r->ops_per_s) {
+            r->ops_per_s = calls * ops_per_call * 1e9 / elapsed;
+            r->mb_per_s = bytes * 1e9 / elapsed / (1024.0 * 1024.0);
+        }
+    }
+    printf("%-14s %14.0f ops/s %10.1f MB/s\n", r->name, r->ops_per_s, r->mb_per_s);
+    fflush(stdout);
+}
+
+static bool write_json(const bench_config* cfg)
+{
+    FILE* fd = fopen(cfg->json, "w");
+
+    if (fd == NULL) {
+        fprintf(stderr, "Cannot create '%s'\n", cfg->json);
+        return false;
+    }
+    fprintf(fd, "{\n  \"config\": { \"count\": %d, \"duplicates\": %.3f, \"psm\": %.3f, \"corrupt\": %.3f, \"seed\": %u, "
+        "\"tsv_size\": %d },\n", (int)cfg->count, cfg->duplicates, cfg->psm, cfg->corrupt, cfg->seed, (int)cfg->tsv_size);
+    fprintf(fd, "  \"benchmarks\": {");
+    for (size_t i = 0; i < nb_results; i++)
+        fprintf(fd, "%s\n    \"%s\": { \"ops_per_s\": %.0f, \"mb_per_s\": %.1f }", (i == 0) ? "" : ",",
+            results[i].name, results[i].ops_per_s, results[i].mb_per_s);
+    fprintf(fd, "\n  }\n}\n");
+    fclose(fd);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    bench_config cfg = { 100000, 0.05, 0.15, 0.001, 0x5eed, 100, "bench", NULL, false };
+    bench_context ctx;
+    corpus c = { NULL, 0, 0 };
+    char *csv = NULL, *xml = NULL, *tsv = NULL;
+    uint8_t *xlsx = NULL, *deflated = NULL;
+    rif_sample* rifs = NULL;
+    size_t csv_len = 0, xml_len = 0, xlsx_len = 0, tsv_len = 0;
+    size_t nb_files;
+    int ret = 1;
+
+    zip_init();
+    for (int i = 1; i < argc; i++) {
+        bool help = (strcmp(argv[i], "-h") == 0) || (strcmp(argv[i], "--help") == 0);
+        if (strcmp(argv[i], "--check") == 0) {
+            cfg.check = true;
+            continue;
+        }
+        /* Every other option takes a value */
+        if (help || (i + 1 >= argc)) {
+            printf("Usage: vitali_bench [--check] [--count N] [--duplicates RATIO] [--psm RATIO] [--corrupt RATIO]\n");
+            printf("                    [--seed N] [--tsv-size MB] [--dir DIR] [--json FILE]\n");
+            return help ? 0 : 1;
+        }
+        if (strcmp(argv[i], "--count") == 0)
+            cfg.count = (size_t)strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--duplicates") == 0)
+            cfg.duplicates = atof(argv[++i]);
+        else if (strcmp(argv[i], "--psm") == 0)
+            cfg.psm = atof(argv[++i]);
+        else if (strcmp(argv[i], "--corrupt") == 0)
+            cfg.corrupt = atof(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0)
+            cfg.seed = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--tsv-size") == 0)
+            cfg.tsv_size = (size_t)strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--dir") == 0)
+            cfg.dir = argv[++i];
+        else if (strcmp(argv[i], "--json") == 0)
+            cfg.json = argv[++i];
+    }
+    if ((cfg.count == 0) || (cfg.seed == 0)) {
+        fprintf(stderr, "The number of licenses and the seed must not be zero\n");
+        return 1;
+    }
+
+    printf("Generating %d licenses (%.1f%% duplicates, %.1f%% PSM, %.2f%% corrupted) in '%s'...\n",
+        (int)cfg.count, cfg.duplicates * 100.0, cfg.psm * 100.0, cfg.corrupt * 100.0, cfg.dir);
+    if (!make_corpus(&cfg, &c)) {
+        fprintf(stderr, "Cannot generate licenses\n");
+        goto out;
+    }
+    rifs = make_rif_samples(cfg.seed, NB_SAMPLE_RIFS);
+    if ((rifs == NULL) || !check_encode_zrif(rifs, NB_SAMPLE_RIFS)) {
+        fprintf(stderr, "The zRIF encoder check failed\n");
+        goto out;
+    }
+    if (cfg.check) {
+        mkdir(cfg.dir, 0755);
+        csv = make_feed(&c, "csv", 0, c.count, &csv_len);
+        /* The CSV feed is left for the download checks to serve */
+        if ((csv == NULL) || !write_file(cfg.dir, "feed.csv", csv, csv_len) ||
+            !check_puff_padded(rifs, NB_SAMPLE_RIFS, csv, csv_len) || !check_zip64(&c, cfg.dir)) {
+            fprintf(stderr, "The self-checks failed\n");
+            goto out;
+        }
+        printf("All the self-checks passed\n");
+        ret = 0;
+        goto out;
+    }
+    csv = make_feed(&c, "csv", 0, c.count, &csv_len);
+    xml = make_feed(&c, "xml", 0, c.count, &xml_len);
+    xlsx = make_xlsx(&c, &xlsx_len);
+    tsv = make_tsv(&c, cfg.tsv_size * 1024 * 1024, cfg.seed, &tsv_len);
+    deflated = malloc(csv_len + csv_len / 8 + 16);
+    if ((csv == NULL) || (xml == NULL) || (xlsx == NULL) || (tsv == NULL) || (deflated == NULL)) {
+        fprintf(stderr, "Cannot allocate feeds\n");
+        goto out;
+    }
+    mkdir(cfg.dir, 0755);
+    if (!write_file(cfg.dir, "feed.csv", csv, csv_len) || !write_file(cfg.dir, "feed.xml", xml, xml_len) ||
+        !write_file(cfg.dir, "feed.xlsx", xlsx, xlsx_len) || !write_file(cfg.dir, "feed.tsv", tsv, tsv_len) ||
+        !make_rif_tree(&c, cfg.dir, "feed.rif", &nb_files))
+        goto out;
+    printf("Wrote %d .rif files to '%s/feed.rif'\n", (int)nb_files, cfg.dir);
+    /* Both scans must find every license of the TSV, and nothing else */
+    if (count_zrifs_csv(tsv, tsv_len) != count_zrifs_memchr(tsv, tsv_len)) {
+        fprintf(stderr, "The scans of the TSV feed don't agree\n");
+        goto out;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.zrifs = &c;
+    ctx.rifs = rifs;
+    ctx.nb_rifs = NB_SAMPLE_RIFS;
+    ctx.text = (const uint8_t*)csv;
+    ctx.text_len = csv_len;
+    ctx.deflated = deflated;
+    ctx.deflated_len = deflate_fixed((const uint8_t*)csv, 0, csv_len, DEFLATE_WINDOW, deflated,
+        csv_len + csv_len / 8 + 16);
+    if (ctx.deflated_len == 0) {
+        fprintf(stderr, "Cannot compress the CSV feed\n");
+        goto out;
+    }
+    if (!check_puff_padded(rifs, NB_SAMPLE_RIFS, csv, csv_len)) {
+        fprintf(stderr, "The padded inflate check failed\n");
+        goto out;
+    }
+    ctx.xlsx = xlsx;
+    ctx.xlsx_len = xlsx_len;
+    ctx.tsv = tsv;
+    ctx.tsv_len = tsv_len;
+    /* Room for the inflated CSV, or all the XLSX members */
+    ctx.out_len = 4 * csv_len + PUFF_SLACK;
+    ctx.out = malloc(ctx.out_len);
+    if (ctx.out == NULL) {
+        fprintf(stderr, "Cannot allocate buffer\n");
+        goto out;
+    }
+
+    run_bench("decode_zrif", bench_decode_zrif, &ctx, c.count);
+    run_bench("encode_zrif", bench_encode_zrif, &ctx, NB_SAMPLE_RIFS);
+    run_bench("base64_decode", bench_base64_decode, &ctx, c.count);
+    run_bench("puff", bench_puff, &ctx, 1);
+    run_bench("adler32", bench_adler32, &ctx, 1);
+    run_bench("crc32", bench_crc32, &ctx, 1);
+    run_bench("unzip_xlsx", bench_unzip, &ctx, 1);
+    run_bench("unzip_xlsx_serial", bench_unzip_serial, &ctx, 1);
+    run_bench("scan_memchr", bench_scan_memchr, &ctx, 1);
+    run_bench("scan_csv", bench_scan_csv, &ctx, 1);
+    free(ctx.out);
+
+    ret = ((cfg.json == NULL) || write_json(&cfg)) ? 0 : 1;
+
+out:
+    free(csv);
+    free(xml);
+    free(xlsx);
+    free(tsv);
+    free(deflated);
+    free(rifs);
+    free_corpus(&c);
+    return ret;
+}
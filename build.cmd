@@ -10,6 +10,6 @@ set CL=%CL% /Ox
 rem set CL=%CL% /Od /Zi
 rem set LINK=%LINK% /DEBUG
 
-cl.exe puff.c sqlite3.c zrif.c vitali.c /Fe%APP_NAME%
+cl.exe csv.c filter.c puff.c rifcache.c rifdir.c sqlite3.c stats.c unzip.c xml.c zrif.c vitali.c /Fe%APP_NAME%
 if %ERRORLEVEL% equ 0 echo =^> %APP_NAME%
 pause
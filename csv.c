@@ -0,0 +1,225 @@
+/*
+  Vitali - Vita License database updater
+  Copyright © 2017-2018 - VitaSmith
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <ctype.h>
+#include <string.h>
+
+#include "csv.h"
+#include "simd.h"
+
+/* Delimiters we try, in order of preference, when looking at the header */
+static const char csv_delimiters[] = "\t,;|";
+
+#if defined(USE_SSE2) || defined(USE_NEON)
+/* Bit i is set if p[i] is either a, b or c, for the 16 bytes at p */
+static inline unsigned int match_mask(const char* p, char a, char b, char c)
+{
+#if defined(USE_SSE2)
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    return (unsigned int)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(a)),
+        _mm_cmpeq_epi8(v, _mm_set1_epi8(b))), _mm_cmpeq_epi8(v, _mm_set1_epi8(c))));
+#else
+    static const uint8_t bits[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+    uint8x16_t v = vld1q_u8((const uint8_t*)p);
+    uint8x16_t m = vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8((uint8_t)a)), vceqq_u8(v, vdupq_n_u8((uint8_t)b))),
+        vceqq_u8(v, vdupq_n_u8((uint8_t)c)));
+    /* No movemask on ARM, so add up the weighted lanes of each half instead */
+    uint8x8_t t = vpadd_u8(vget_low_u8(vandq_u8(m, vld1q_u8(bits))), vget_high_u8(vandq_u8(m, vld1q_u8(bits))));
+    t = vpadd_u8(t, t);
+    t = vpadd_u8(t, t);
+    return vget_lane_u8(t, 0) | ((unsigned int)vget_lane_u8(t, 1) << 8);
+#endif
+}
+#endif
+
+/* Return the first occurrence of either a, b or c in [p, end), or end if there is none */
+static const char* find_any(const char* p, const char* end, char a, char b, char c)
+{
+    /* The C library's memchr() is usually at least as fast as we are for a single character */
+    if ((a == b) && (b == c)) {
+        p = memchr(p, a, end - p);
+        return (p == NULL) ? end : p;
+    }
+#if defined(USE_SSE2) || defined(USE_NEON)
+    for (unsigned int mask; end - p >= 16; p += 16) {
+        mask = match_mask(p, a, b, c);
+        if (mask != 0)
+            return &p[ctz(mask)];
+    }
+#endif
+    for (; p < end; p++) {
+        if ((*p == a) || (*p == b) || (*p == c))
+            return p;
+    }
+    return end;
+}
+
+/* Update the state of the parser for a delimiter, newline or quote */
+static inline void update_state(csv_parser* csv, char c)
+{
+    if ((csv->quote != 0) && (c == csv->quote)) {
+        /* A doubled quote within a quoted field toggles twice, which is what we want */
+        csv->in_quotes = !csv->in_quotes;
+    } else if (c == '\n') {
+        csv->row++;
+        csv->field = 0;
+        csv->field_start = true;
+    } else {
+        csv->field++;
+        csv->field_start = true;
+    }
+}
+
+/*
+ * Go through the fields that come before the selected column, which tend to
+ * be short, handling all the delimiters from a block of 16 bytes at once. Stop
+ * right after the character that gets us into that column or into a quoted
+ * field, or when fewer than 16 bytes are left.
+ */
+static const char* skip_fields(csv_parser* csv, const char* p, const char* end)
+{
+#if defined(USE_SSE2) || defined(USE_NEON)
+    const char quote = (csv->quote != 0) ? csv->quote : '\n';
+
+    for (unsigned int mask; end - p >= 16; p += 16) {
+        for (mask = match_mask(p, csv->delimiter, '\n', quote); mask != 0; mask &= mask - 1) {
+            int i = ctz(mask);
+            update_state(csv, p[i]);
+            if (csv->in_quotes || (csv->field == csv->column))
+                return &p[i + 1];
+        }
+    }
+#else
+    (void)csv;
+    (void)end;
+#endif
+    return p;
+}
+
+/* Remove leading and trailing whitespace from the len bytes at *str */
+static void trim(const char** str, size_t* len)
+{
+    while ((*len > 0) && isspace((unsigned char)(*str)[*len - 1]))
+        (*len)--;
+    while ((*len > 0) && isspace((unsigned char)**str)) {
+        (*str)++;
+        (*len)--;
+    }
+}
+
+/* Compare a header field to name, ignoring case, surrounding quotes and whitespace */
+static bool is_column(const char* field, size_t len, const char* name)
+{
+    size_t name_len = strlen(name);
+
+    trim(&field, &len);
+    if ((len >= 2) && (field[0] == '"') && (field[len - 1] == '"')) {
+        field++;
+        len -= 2;
+        trim(&field, &len);
+    }
+    if (len != name_len)
+        return false;
+    for (size_t i = 0; i < len; i++) {
+        if (tolower((unsigned char)field[i]) != tolower((unsigned char)name[i]))
+            return false;
+    }
+    return true;
+}
+
+bool csv_init(csv_parser* csv, const char* buf, size_t size, const char* name)
+{
+    const char *eol, *p, *q;
+    char quote;
+    bool in_quotes;
+    int field;
+
+    memset(csv, 0, sizeof(*csv));
+    csv->column = -1;
+    eol = memchr(buf, '\n', (size < CSV_MAX_HEADER) ? size : CSV_MAX_HEADER);
+    if (eol == NULL)
+        return false;
+    for (const char* d = csv_delimiters; *d != 0; d++) {
+        if (memchr(buf, *d, eol - buf) == NULL)
+            continue;
+        quote = (*d == '\t') ? 0 : '"';
+        in_quotes = false;
+        for (p = q = buf, field = 0; q <= eol; q++) {
+            if ((q < eol) && (quote != 0) && (*q == quote)) {
+                in_quotes = !in_quotes;
+            } else if ((q == eol) || (!in_quotes && (*q == *d))) {
+                if (is_column(p, q - p, name)) {
+                    csv->delimiter = *d;
+                    csv->quote = quote;
+                    csv->column = field;
+                    csv->field_start = true;
+                    return true;
+                }
+                p = q + 1;
+                field++;
+            }
+        }
+    }
+    return false;
+}
+
+/* Skip the spaces, and tabs if they aren't the delimiter, that values are often padded with */
+static inline const char* skip_blanks(const csv_parser* csv, const char* p, const char* end)
+{
+    while ((p < end) && ((*p == ' ') || ((*p == '\t') && (csv->delimiter != '\t'))))
+        p++;
+    return p;
+}
+
+const char* csv_next_field(csv_parser* csv, const char* p, const char* end)
+{
+    /* With no quoting, look for newlines in place of quotes */
+    const char quote = (csv->quote != 0) ? csv->quote : '\n';
+
+    for (;;) {
+        if (csv->field_start) {
+            if (csv->field == csv->column) {
+                /* As in "a, b" or 'a, " b"', where field_start is kept if the chunk ends first */
+                p = skip_blanks(csv, p, end);
+                if ((csv->quote != 0) && !csv->in_quotes && (p < end) && (*p == csv->quote)) {
+                    csv->in_quotes = true;
+                    p = skip_blanks(csv, p + 1, end);
+                }
+                if (p >= end)
+                    return NULL;
+                csv->field_start = false;
+                return p;
+            }
+            csv->field_start = false;
+        }
+        if (csv->in_quotes) {
+            p = find_any(p, end, quote, quote, quote);
+        } else if (csv->field >= csv->column) {
+            /* Past the selected column, only the end of the row matters */
+            p = find_any(p, end, '\n', quote, quote);
+        } else {
+            p = skip_fields(csv, p, end);
+            if (csv->in_quotes || (csv->field == csv->column))
+                continue;
+            p = find_any(p, end, csv->delimiter, '\n', quote);
+        }
+        if (p >= end)
+            return NULL;
+        update_state(csv, *p++);
+    }
+}
@@ -0,0 +1,58 @@
+/*
+  Vitali - Vita License database updater
+  Copyright © 2017-2018 - VitaSmith
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Column-aware scanning of delimited text (CSV, TSV, ...), so that only the
+ * field that holds the zRIFs is looked at, rather than every byte of names,
+ * URLs and hashes. Rows end with '\n' and, except with tabs, fields may be
+ * quoted with '"', in which case they can contain delimiters and newlines.
+ */
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Longest header line that is looked at */
+#define CSV_MAX_HEADER      4096
+
+typedef struct {
+    char delimiter;
+    char quote;                 /* 0 if fields are never quoted */
+    int column;                 /* index of the selected column, -1 if none */
+    /* Parsing state, carried over from one chunk to the next */
+    int field;
+    bool field_start;
+    bool in_quotes;
+    uint64_t row;               /* 0 for the header */
+} csv_parser;
+
+/*
+ * Look for a column called name (case insensitive) in the header line at the
+ * start of buf, and set the parser up for it. Returns false, with column set
+ * to -1, if buf doesn't start with a delimited header that has such a column.
+ */
+bool csv_init(csv_parser* csv, const char* buf, size_t size, const char* name);
+
+/*
+ * Return the start of the next field of the selected column, at or after p,
+ * with any leading blanks and opening quote skipped. The returned pointer is always below end.
+ * Returns NULL if the chunk ends first, in which case the search carries on
+ * from the start of the next chunk.
+ */
+const char* csv_next_field(csv_parser* csv, const char* p, const char* end);
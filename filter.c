@@ -0,0 +1,271 @@
+/*
+  Vitali - Vita License database updater
+  Copyright © 2017-2018 - VitaSmith
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "filter.h"
+
+/* Characters that can be found in a CONTENT_ID: A-Z, 0-9, '-' and '_' */
+#define FILTER_SYMBOLS          38
+#define FILTER_MAX_ITEM         64
+#define FILTER_MAX_PATH         512
+#define FNV32_OFFSET            0x811c9dc5U
+#define FNV32_PRIME             0x01000193U
+
+struct filter_node {
+    int32_t next[FILTER_SYMBOLS];
+    bool end;
+};
+
+static const struct {
+    const char* name;
+    char letter;
+} region_names[] = {
+    { "US", 'U' },
+    { "EU", 'E' },
+    { "JP", 'J' },
+    { "ASIA", 'H' },
+};
+
+static int symbol(char c)
+{
+    if ((c >= 'A') && (c <= 'Z'))
+        return c - 'A';
+    if ((c >= '0') && (c <= '9'))
+        return 26 + c - '0';
+    if (c == '-')
+        return 36;
+    if (c == '_')
+        return 37;
+    return -1;
+}
+
+static uint32_t hash_title_id(const char* title_id)
+{
+    uint32_t h = FNV32_OFFSET;
+
+    for (int i = 0; i < FILTER_TITLE_ID_LEN; i++)
+        h = (h ^ (uint8_t)title_id[i]) * FNV32_PRIME;
+    return h;
+}
+
+/* TITLE_IDs look like PCSE00001 */
+static bool is_title_id(const char* item)
+{
+    for (int i = 0; i < FILTER_TITLE_ID_LEN; i++) {
+        if ((i < 4) ? ((item[i] < 'A') || (item[i] > 'Z')) : ((item[i] < '0') || (item[i] > '9')))
+            return false;
+    }
+    return (item[FILTER_TITLE_ID_LEN] == 0);
+}
+
+/* Find the slot of title_id, or the free slot where it belongs */
+static uint32_t find_title(const content_filter* f, const char* title_id)
+{
+    uint32_t mask = f->max_titles - 1, i = hash_title_id(title_id) & mask;
+
+    while ((f->titles[i][0] != 0) && (memcmp(f->titles[i], title_id, FILTER_TITLE_ID_LEN) != 0))
+        i = (i + 1) & mask;
+    return i;
+}
+
+static bool add_title(content_filter* f, const char* title_id)
+{
+    uint32_t i;
+
+    /* Keep the table at most half full, so that probe sequences stay short */
+    if (2 * (f->nb_titles + 1) > f->max_titles) {
+        content_filter g = *f;
+        g.max_titles = (f->max_titles == 0) ? 64 : 2 * f->max_titles;
+        g.titles = calloc(g.max_titles, FILTER_TITLE_ID_LEN);
+        if (g.titles == NULL)
+            return false;
+        for (i = 0; i < f->max_titles; i++) {
+            if (f->titles[i][0] != 0)
+                memcpy(g.titles[find_title(&g, f->titles[i])], f->titles[i], FILTER_TITLE_ID_LEN);
+        }
+        free(f->titles);
+        f->titles = g.titles;
+        f->max_titles = g.max_titles;
+    }
+    i = find_title(f, title_id);
+    if (f->titles[i][0] == 0) {
+        memcpy(f->titles[i], title_id, FILTER_TITLE_ID_LEN);
+        f->nb_titles++;
+    }
+    return true;
+}
+
+static int32_t new_node(content_filter* f)
+{
+    if (f->nb_nodes >= f->max_nodes) {
+        uint32_t max_nodes = (f->max_nodes == 0) ? 64 : 2 * f->max_nodes;
+        struct filter_node* nodes = realloc(f->nodes, max_nodes * sizeof(struct filter_node));
+        if (nodes == NULL)
+            return -1;
+        f->nodes = nodes;
+        f->max_nodes = max_nodes;
+    }
+    memset(&f->nodes[f->nb_nodes], 0, sizeof(struct filter_node));
+    return (int32_t)f->nb_nodes++;
+}
+
+static bool add_prefix(content_filter* f, const char* prefix)
+{
+    int32_t n = 0, next;
+
+    if ((f->nb_nodes == 0) && (new_node(f) < 0))
+        return false;
+    for (; *prefix != 0; prefix++) {
+        int s = symbol(*prefix);
+        if (s < 0)
+            return false;
+        next = f->nodes[n].next[s];
+        if (next == 0) {
+            /* f->nodes may move */
+            next = new_node(f);
+            if (next < 0)
+                return false;
+            f->nodes[n].next[s] = next;
+        }
+        n = next;
+    }
+    f->nodes[n].end = true;
+    f->nb_prefixes++;
+    return true;
+}
+
+static bool add_item(content_filter* f, const char* item)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(region_names) / sizeof(region_names[0]); i++) {
+        if (strcmp(item, region_names[i].name) == 0) {
+            if (!f->regions[(uint8_t)region_names[i].letter])
+                f->nb_regions++;
+            f->regions[(uint8_t)region_names[i].letter] = true;
+            return true;
+        }
+    }
+    if (strcmp(item, "VITA") == 0) {
+        f->types |= FILTER_TYPE_VITA;
+        return true;
+    }
+    if (strcmp(item, "PSM") == 0) {
+        f->types |= FILTER_TYPE_PSM;
+        return true;
+    }
+    if (is_title_id(item))
+        return add_title(f, item);
+    return add_prefix(f, item);
+}
+
+static bool add_file(content_filter* f, const char* path)
+{
+    char line[1024];
+    bool r = true;
+    FILE* fd = fopen(path, "r");
+
+    if (fd == NULL)
+        return false;
+    while (r && (fgets(line, sizeof(line), fd) != NULL)) {
+        /* Lines can hold several items, separated by commas or spaces, and comments */
+        char* p = strchr(line, '#');
+        if (p != NULL)
+            *p = 0;
+        for (p = line; *p != 0; p++) {
+            if (isspace((uint8_t)*p))
+                *p = ',';
+        }
+        r = filter_add(f, line);
+    }
+    fclose(fd);
+    return r;
+}
+
+void filter_init(content_filter* f)
+{
+    memset(f, 0, sizeof(*f));
+}
+
+bool filter_add(content_filter* f, const char* list)
+{
+    char item[FILTER_MAX_PATH];
+    const char *p = list, *q;
+    size_t i, len;
+
+    for (; *p != 0; p = (*q == 0) ? q : q + 1) {
+        q = strchr(p, ',');
+        if (q == NULL)
+            q = &p[strlen(p)];
+        len = (size_t)(q - p);
+        /* Empty items, such as the ones of blank lines, are ignored */
+        if (len == 0)
+            continue;
+        if (len >= ((p[0] == '@') ? FILTER_MAX_PATH : FILTER_MAX_ITEM))
+            return false;
+        /* File names are the only items where case matters */
+        for (i = 0; i < len; i++)
+            item[i] = (p[0] == '@') ? p[i] : (char)toupper((uint8_t)p[i]);
+        item[len] = 0;
+        if (!((item[0] == '@') ? add_file(f, &item[1]) : add_item(f, item)))
+            return false;
+    }
+    return true;
+}
+
+bool filter_match(const content_filter* f, const char* content_id)
+{
+    const char* title_id = &content_id[7];
+    /* Only CONTENT_IDs that are long enough to hold a TITLE_ID can match a title or a type */
+    bool has_title_id = (strnlen(content_id, 7 + FILTER_TITLE_ID_LEN) == 7 + FILTER_TITLE_ID_LEN);
+    int32_t n;
+    int i;
+
+    if ((f->nb_regions != 0) && !f->regions[(uint8_t)content_id[0]])
+        return false;
+    /* Vita TITLE_IDs start with PCS, and PSM ones with NP */
+    if ((f->types != 0) && (!has_title_id ||
+        (!((f->types & FILTER_TYPE_VITA) && (memcmp(title_id, "PCS", 3) == 0)) &&
+         !((f->types & FILTER_TYPE_PSM) && (memcmp(title_id, "NP", 2) == 0)))))
+        return false;
+    if ((f->nb_titles == 0) && (f->nb_prefixes == 0))
+        return true;
+    if ((f->nb_titles != 0) && has_title_id && (f->titles[find_title(f, title_id)][0] != 0))
+        return true;
+    for (i = 0, n = 0; f->nb_prefixes != 0; i++) {
+        int s;
+        if (f->nodes[n].end)
+            return true;
+        s = symbol(content_id[i]);
+        if ((s < 0) || (f->nodes[n].next[s] == 0))
+            return false;
+        n = f->nodes[n].next[s];
+    }
+    return false;
+}
+
+void filter_free(content_filter* f)
+{
+    free(f->titles);
+    free(f->nodes);
+    memset(f, 0, sizeof(*f));
+}
@@ -0,0 +1,71 @@
+/*
+  Vitali - Vita License database updater
+  Copyright © 2017-2018 - VitaSmith
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Allowlist of licenses, matched against their CONTENT_ID, which looks like
+ * UP0001-PCSE00001_00-0000000000000001: a service ID, whose first letter is
+ * the region, then a TITLE_ID and a label. The list is compiled into a hash
+ * set of TITLE_IDs, a trie of CONTENT_ID prefixes and lookup tables of regions
+ * and content types, so that matching only costs a few memory accesses.
+ *
+ * Items of the same kind are alternatives, whereas kinds are combined, so that
+ * "EU,PCSB00001,PCSB00002" keeps the European licenses of either title.
+ */
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define FILTER_TITLE_ID_LEN     9
+#define FILTER_TYPE_VITA        0x01
+#define FILTER_TYPE_PSM         0x02
+
+typedef struct {
+    /* Open addressing, with an empty TITLE_ID for free slots */
+    char (*titles)[FILTER_TITLE_ID_LEN];
+    uint32_t nb_titles, max_titles;
+    /* Trie of the CONTENT_ID prefixes, with node 0 as the root */
+    struct filter_node* nodes;
+    uint32_t nb_nodes, max_nodes, nb_prefixes;
+    /* Indexed by the first letter of CONTENT_ID */
+    bool regions[256];
+    uint32_t nb_regions;
+    uint8_t types;
+} content_filter;
+
+void filter_init(content_filter* f);
+
+/*
+ * Add a comma separated list of items, each of which is either a TITLE_ID
+ * (PCSE00001), a region (US, EU, JP or ASIA), a content type (VITA or PSM),
+ * a CONTENT_ID prefix (UP0001-PCSE00001), or @FILE, for a file with one or
+ * more items per line. Case is ignored, except in file names. Returns false
+ * if an item is invalid or a file can't be read.
+ */
+bool filter_add(content_filter* f, const char* list);
+
+/* Whether any item was added */
+static inline bool filter_is_set(const content_filter* f)
+{
+    return (f->nb_titles != 0) || (f->nb_prefixes != 0) || (f->nb_regions != 0) || (f->types != 0);
+}
+
+bool filter_match(const content_filter* f, const char* content_id);
+
+void filter_free(content_filter* f);
@@ -7,7 +7,9 @@
 
 #include <setjmp.h>             /* for setjmp(), longjmp(), and jmp_buf */
 #include <stdint.h>             /* because we're not savages */
+#include <string.h>             /* for memmove(), memcpy() and memset() */
 #include "puff.h"               /* prototype for puff() */
+#include "thread.h"             /* for per_thread and atomic_add() */
 
 #define local static            /* for local function definitions */
 
@@ -20,6 +22,8 @@
 #define MAXDCODES 30            /* maximum number of distance codes */
 #define MAXCODES (MAXLCODES+MAXDCODES)  /* maximum codes lengths to read */
 #define FIXLCODES 288           /* number of fixed literal/length codes */
+#define MAXDIST 32768           /* maximum distance for a back-reference */
+#define MAXMATCH 258            /* maximum length for a back-reference */
 
 /* input and output state */
 struct state {
@@ -31,10 +35,24 @@ struct state {
     /* input state */
     const uint8_t *in;          /* input buffer */
     size_t inlen;               /* available input at in */
+    size_t inend;               /* input limit for bits() and decode() */
     size_t incnt;               /* bytes read so far */
     int bitbuf;                 /* bit buffer */
     int bitcnt;                 /* number of bits in bit buffer */
 
+    /* optional running checksum of the output */
+    puff_checksum checksum;     /* checksum function or NULL */
+    uint32_t sum;               /* current value of the checksum */
+
+    /* optional streaming of the output through a sliding window */
+    puff_flush flush;           /* output consumer or NULL */
+    void *opaque;               /* consumer context */
+    size_t done;                /* bytes of out already summed and flushed */
+    size_t slid;                /* bytes that were slid out of the window */
+
+    /* stop rather than fail when the output space is exhausted */
+    int partial;
+
     /* input limit error return state for bits() and decode() */
     jmp_buf env;
 };
@@ -57,7 +75,7 @@ local int bits(struct state *s, int need)
     /* load at least need bits into val */
     val = s->bitbuf;
     while (s->bitcnt < need) {
-        if (s->incnt == s->inlen)
+        if (s->incnt == s->inend)
             longjmp(s->env, 1);         /* out of input */
         val |= (long)(s->in[s->incnt++]) << s->bitcnt;  /* load eight bits */
         s->bitcnt += 8;
@@ -71,6 +89,48 @@ local int bits(struct state *s, int need)
     return (int)(val & ((1L << need) - 1));
 }
 
+/*
+ * Update the checksum with, and hand over to the consumer if streaming, the
+ * output that was produced since the last call.  Returns 3 if the consumer
+ * requested to stop.
+ */
+local int emit(struct state *s)
+{
+    size_t len = s->outcnt - s->done;
+
+    if (len == 0)
+        return 0;
+    if (s->checksum != NULL)
+        s->sum = s->checksum(s->sum, s->out + s->done, len);
+    s->done = s->outcnt;
+    if (s->flush != NULL && s->flush(s->opaque, s->out + s->outcnt - len, len) != 0)
+        return 3;
+    return 0;
+}
+
+/*
+ * Make room for len more bytes of output.  Without a consumer, the output
+ * space is simply exhausted.  When streaming, the pending output is handed
+ * over, and the last MAXDIST bytes are slid to the start of the window, so
+ * that back-references remain valid.
+ */
+local int slide(struct state *s, size_t len)
+{
+    size_t keep;        /* bytes of history to retain */
+    int err;
+
+    if (s->flush == NULL)
+        return s->partial ? 3 : 1;              /* not enough output space */
+    err = emit(s);
+    if (err != 0)
+        return err;
+    keep = s->outcnt < MAXDIST ? s->outcnt : MAXDIST;
+    memmove(s->out, s->out + s->outcnt - keep, keep);
+    s->slid += s->outcnt - keep;
+    s->outcnt = s->done = keep;
+    return s->outcnt + len > s->outlen;         /* window is too small */
+}
+
 /*
  * Process a stored block.
  *
@@ -91,6 +151,7 @@ local int bits(struct state *s, int need)
 local int stored(struct state *s)
 {
     size_t len;       /* length of stored block */
+    int err;          /* slide() return value */
 
     /* discard leftover bits from current byte (assumes s->bitcnt < 8) */
     s->bitbuf = 0;
@@ -109,10 +170,11 @@ local int stored(struct state *s)
     if (s->incnt + len > s->inlen)
         return 2;                               /* not enough input */
     if (s->out != NIL) {
-        if (s->outcnt + len > s->outlen)
-            return 1;                           /* not enough output space */
-        while (len--)
+        while (len--) {
+            if (s->outcnt == s->outlen && (err = slide(s, 1)) != 0)
+                return err;
             s->out[s->outcnt++] = s->in[s->incnt++];
+        }
     } else {                                      /* just scanning */
         s->outcnt += len;
         s->incnt += len;
@@ -192,7 +254,7 @@ local int decode(struct state *s, const struct huffman *h)
         left = (MAXBITS + 1) - len;
         if (left == 0)
             break;
-        if (s->incnt == s->inlen)
+        if (s->incnt == s->inend)
             longjmp(s->env, 1);         /* out of input */
         bitbuf = s->in[s->incnt++];
         if (left > 8)
@@ -274,6 +336,51 @@ local int construct(struct huffman *h, const uint16_t *length, int n)
     return left;
 }
 
+/*
+ * Copy len bytes from dist bytes back, using 8 or 16 byte wide copies rather
+ * than one byte at a time.  The last wide copy may write up to PUFF_SLACK - 1
+ * bytes past the end of the match, so the caller must ensure that this space
+ * is available (it is overwritten by subsequent output anyway).
+ *
+ * Overlapped copies (dist < len) are valid since each wide copy reads data
+ * that is at least its own width back, and therefore already written.  For
+ * distances shorter than 8, the first 8 bytes are copied one at a time, after
+ * which the output is periodic with a period that is the smallest multiple of
+ * dist that is at least 8, and which can be used as the new distance.  A
+ * distance of one, used for runs such as the zeros of RIFs, is a memset().
+ */
+local void copy(struct state *s, size_t dist, int len)
+{
+    uint8_t *to = s->out + s->outcnt;   /* destination of the copy */
+    uint8_t *end = to + len;            /* end of the copy */
+
+    s->outcnt += len;
+    if (dist == 1) {
+        memset(to, to[-1], len);
+        return;
+    }
+    if (dist < 8) {
+        int n = len < 8 ? len : 8;
+        while (n--) {
+            *to = *(to - dist);
+            to++;
+        }
+        dist *= (8 + dist - 1) / dist;
+    }
+    if (dist >= 16) {
+        while (to < end) {
+            memcpy(to, to - dist, 8);
+            memcpy(to + 8, to + 8 - dist, 8);
+            to += 16;
+        }
+    } else {
+        while (to < end) {
+            memcpy(to, to - dist, 8);
+            to += 8;
+        }
+    }
+}
+
 /*
  * Decode literal/length and distance codes until an end-of-block code.
  *
@@ -336,6 +443,7 @@ local int codes(struct state *s,
     int symbol;         /* decoded symbol */
     int len;            /* length for copy */
     size_t dist;        /* distance for copy */
+    int err;            /* slide() return value */
     static const uint16_t lens[29] = { /* Size base for length codes 257..285 */
         3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
         35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
@@ -353,14 +461,16 @@ local int codes(struct state *s,
 
     /* decode literals and length/distance pairs */
     do {
+        if (s->incnt > s->inlen)
+            return 2;                   /* overran padded input */
         symbol = decode(s, lencode);
         if (symbol < 0)
             return symbol;              /* invalid symbol */
         if (symbol < 256) {             /* literal: symbol is the byte */
             /* write out the literal */
             if (s->out != NIL) {
-                if (s->outcnt == s->outlen)
-                    return 1;
+                if (s->outcnt == s->outlen && (err = slide(s, 1)) != 0)
+                    return err;
                 s->out[s->outcnt] = (unsigned char)symbol;
             }
             s->outcnt++;
@@ -383,8 +493,13 @@ local int codes(struct state *s,
 
             /* copy length bytes from distance bytes back */
             if (s->out != NIL) {
-                if (s->outcnt + len > s->outlen)
-                    return 1;
+                if (s->outcnt + len > s->outlen && (err = slide(s, len)) != 0)
+                    return err;
+#ifndef INFLATE_ALLOW_INVALID_DISTANCE_TOOFAR_ARRR
+                if (s->outcnt + len + PUFF_SLACK <= s->outlen)
+                    copy(s, dist, len);
+                else
+#endif
                 while (len--) {
                     s->out[s->outcnt] =
 #ifdef INFLATE_ALLOW_INVALID_DISTANCE_TOOFAR_ARRR
@@ -413,7 +528,7 @@ local int codes(struct state *s,
  *   benefit of custom codes for that block.  For fixed codes, no bits are
  *   spent on code descriptions.  Instead the code lengths for literal/length
  *   codes and distance codes are fixed.  The specific lengths for each symbol
- *   can be seen in the "for" loops below.
+ *   are given in the comments below.
  *
  * - The literal/length code is complete, but has two symbols that are invalid
  *   and should result in an error if received.  This cannot be implemented
@@ -426,49 +541,200 @@ local int codes(struct state *s,
  *   in an error if received.  Since all of the distance codes are the same
  *   length, this can be implemented as an incomplete code.  Then the invalid
  *   codes are detected while decoding.
+ *
+ * - The tables are the ones that construct() builds from those lengths.  They
+ *   are precomputed rather than built on the first call, so that concurrent
+ *   calls never see them half-built.
  */
 local int fixed(struct state *s)
 {
-    static int virgin = 1;
-    static uint16_t lencnt[MAXBITS + 1], lensym[FIXLCODES];
-    static uint16_t distcnt[MAXBITS + 1], distsym[MAXDCODES];
-    static struct huffman lencode, distcode;
-
-    /* build fixed huffman tables if first call (may not be thread safe) */
-    if (virgin) {
-        int symbol;
-        uint16_t lengths[FIXLCODES];
-
-        /* construct lencode and distcode */
-        lencode.count = lencnt;
-        lencode.symbol = lensym;
-        distcode.count = distcnt;
-        distcode.symbol = distsym;
-
-        /* literal/length table */
-        for (symbol = 0; symbol < 144; symbol++)
-            lengths[symbol] = 8;
-        for (; symbol < 256; symbol++)
-            lengths[symbol] = 9;
-        for (; symbol < 280; symbol++)
-            lengths[symbol] = 7;
-        for (; symbol < FIXLCODES; symbol++)
-            lengths[symbol] = 8;
-        construct(&lencode, lengths, FIXLCODES);
-
-        /* distance table */
-        for (symbol = 0; symbol < MAXDCODES; symbol++)
-            lengths[symbol] = 5;
-        construct(&distcode, lengths, MAXDCODES);
-
-        /* do this just once */
-        virgin = 0;
-    }
+    /* 7 bits: 256..279, 8 bits: 0..143 and 280..287, 9 bits: 144..255 */
+    static uint16_t lencnt[MAXBITS + 1] = {
+        0, 0, 0, 0, 0, 0, 0, 24, 152, 112, 0, 0, 0, 0, 0, 0
+    };
+    static uint16_t lensym[FIXLCODES] = {
+        256, 257, 258, 259, 260, 261, 262, 263, 264, 265, 266, 267,
+        268, 269, 270, 271, 272, 273, 274, 275, 276, 277, 278, 279,
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+        12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23,
+        24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35,
+        36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47,
+        48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59,
+        60, 61, 62, 63, 64, 65, 66, 67, 68, 69, 70, 71,
+        72, 73, 74, 75, 76, 77, 78, 79, 80, 81, 82, 83,
+        84, 85, 86, 87, 88, 89, 90, 91, 92, 93, 94, 95,
+        96, 97, 98, 99, 100, 101, 102, 103, 104, 105, 106, 107,
+        108, 109, 110, 111, 112, 113, 114, 115, 116, 117, 118, 119,
+        120, 121, 122, 123, 124, 125, 126, 127, 128, 129, 130, 131,
+        132, 133, 134, 135, 136, 137, 138, 139, 140, 141, 142, 143,
+        280, 281, 282, 283, 284, 285, 286, 287, 144, 145, 146, 147,
+        148, 149, 150, 151, 152, 153, 154, 155, 156, 157, 158, 159,
+        160, 161, 162, 163, 164, 165, 166, 167, 168, 169, 170, 171,
+        172, 173, 174, 175, 176, 177, 178, 179, 180, 181, 182, 183,
+        184, 185, 186, 187, 188, 189, 190, 191, 192, 193, 194, 195,
+        196, 197, 198, 199, 200, 201, 202, 203, 204, 205, 206, 207,
+        208, 209, 210, 211, 212, 213, 214, 215, 216, 217, 218, 219,
+        220, 221, 222, 223, 224, 225, 226, 227, 228, 229, 230, 231,
+        232, 233, 234, 235, 236, 237, 238, 239, 240, 241, 242, 243,
+        244, 245, 246, 247, 248, 249, 250, 251, 252, 253, 254, 255
+    };
+    /* 5 bits: 0..29, where 30 and 31 are invalid */
+    static uint16_t distcnt[MAXBITS + 1] = {
+        0, 0, 0, 0, 0, 30, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+    };
+    static uint16_t distsym[MAXDCODES] = {
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+        12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23,
+        24, 25, 26, 27, 28, 29
+    };
+    static const struct huffman lencode = { lencnt, lensym };
+    static const struct huffman distcode = { distcnt, distsym };
 
     /* decode data until end-of-block code */
     return codes(s, &lencode, &distcode);
 }
 
+/*
+ * Cache of the decoding tables built by dynamic().  Inputs that come from the
+ * same deflater with the same preset dictionary, such as zRIFs, often start
+ * with identical dynamic block headers, so the tables built for a header are
+ * kept along with the raw bits of that header.  When the next dynamic block
+ * starts with the same bits, they are skipped and the tables reused, which
+ * saves both the decoding of the code lengths and the calls to construct().
+ *
+ * The cache is two-way set associative on a hash of the first KEYBITS bits of
+ * the header and is local to each thread, so that concurrent puff() calls need
+ * no locking.  Only the hit and miss counts are shared, so that they cover the
+ * worker threads as well.
+ */
+#define CACHE_SETS 8            /* number of sets of two cached headers */
+#define KEYBITS 96              /* header bits that are hashed (multiple of 16) */
+#define MAXHEADER 4496          /* maximum bits in a dynamic block header */
+
+struct cache_entry {
+    uint32_t key;                       /* hash of the first KEYBITS bits */
+    size_t nbits;                       /* header length in bits, 0 if unused */
+    unsigned long used;                 /* time of last use, for replacement */
+    uint16_t raw[MAXHEADER / 16];       /* header bits */
+    uint16_t lencnt[MAXBITS + 1], lensym[MAXLCODES];
+    uint16_t distcnt[MAXBITS + 1], distsym[MAXDCODES];
+    struct huffman lencode, distcode;
+};
+
+local per_thread struct cache_entry cache[CACHE_SETS][2];
+local per_thread unsigned long cache_uses;      /* clock for replacement */
+local volatile long cache_hits, cache_misses;
+
+/* Return the n <= 16 bits starting at bit position pos of the input */
+local unsigned peek(const uint8_t *in, size_t pos, int n)
+{
+    unsigned val = 0;
+    int got = 0, shift = (int)(pos & 7);
+
+    in += pos >> 3;
+    while (got < n) {
+        val |= (unsigned)(*in++ >> shift) << got;
+        got += 8 - shift;
+        shift = 0;
+    }
+    return val & ((1U << n) - 1);
+}
+
+/* Position in bits of the next unread bit of the input */
+local size_t bitpos(const struct state *s)
+{
+    return s->incnt * 8 - (size_t)s->bitcnt;
+}
+
+/* FNV-1a hash of the KEYBITS bits of input starting at bit position pos */
+local uint32_t cache_key(const uint8_t *in, size_t pos)
+{
+    uint32_t key = 2166136261U;
+    int i;
+
+    for (i = 0; i < KEYBITS; i += 16)
+        key = (key ^ peek(in, pos + i, 16)) * 16777619U;
+    return key;
+}
+
+/*
+ * Look for the header that starts at the current input position in the cache.
+ * On a hit, the header is skipped and the cached tables are returned.
+ */
+local struct cache_entry *cache_lookup(struct state *s)
+{
+    struct cache_entry *e;
+    size_t pos = bitpos(s), avail, i;
+    uint32_t key;
+    int way;
+
+    avail = s->inlen * 8 > pos ? s->inlen * 8 - pos : 0;
+    if (avail < KEYBITS)
+        return NULL;
+    key = cache_key(s->in, pos);
+    for (way = 0; way < 2; way++) {
+        e = &cache[key % CACHE_SETS][way];
+        if (e->nbits == 0 || e->key != key || e->nbits > avail)
+            continue;
+        for (i = 0; i < e->nbits / 16; i++)
+            if (peek(s->in, pos + 16 * i, 16) != e->raw[i])
+                break;
+        if (i < e->nbits / 16 || (e->nbits % 16 != 0 &&
+            peek(s->in, pos + 16 * i, (int)(e->nbits % 16)) != e->raw[i]))
+            continue;
+
+        /* skip the header, leaving the bit buffer as bits() would have */
+        pos += e->nbits;
+        s->incnt = (pos + 7) >> 3;
+        s->bitcnt = (int)(s->incnt * 8 - pos);
+        s->bitbuf = s->bitcnt ? s->in[s->incnt - 1] >> (8 - s->bitcnt) : 0;
+        e->used = ++cache_uses;
+        atomic_add(&cache_hits, 1);
+        return e;
+    }
+    cache_uses++;
+    atomic_add(&cache_misses, 1);
+    return NULL;
+}
+
+/* Keep the tables built for the header from bit position start to the current one */
+local void cache_store(struct state *s, size_t start,
+                       const struct huffman *lencode, int nlen,
+                       const struct huffman *distcode, int ndist)
+{
+    struct cache_entry *e;
+    size_t nbits = bitpos(s) - start, i;
+    uint32_t key;
+
+    if (nbits < KEYBITS || nbits > MAXHEADER)
+        return;
+    key = cache_key(s->in, start);
+    e = cache[key % CACHE_SETS];
+    if (e[1].used < e[0].used)
+        e++;                            /* replace the least recently used */
+    e->key = key;
+    e->nbits = nbits;
+    e->used = cache_uses;
+    for (i = 0; i < nbits / 16; i++)
+        e->raw[i] = (uint16_t)peek(s->in, start + 16 * i, 16);
+    if (nbits % 16 != 0)
+        e->raw[i] = (uint16_t)peek(s->in, start + 16 * i, (int)(nbits % 16));
+    memcpy(e->lencnt, lencode->count, sizeof(e->lencnt));
+    memcpy(e->lensym, lencode->symbol, nlen * sizeof(uint16_t));
+    memcpy(e->distcnt, distcode->count, sizeof(e->distcnt));
+    memcpy(e->distsym, distcode->symbol, ndist * sizeof(uint16_t));
+    e->lencode.count = e->lencnt;
+    e->lencode.symbol = e->lensym;
+    e->distcode.count = e->distcnt;
+    e->distcode.symbol = e->distsym;
+}
+
+void puff_cache_stats(unsigned long *hits, unsigned long *misses)
+{
+    *hits = (unsigned long)cache_hits;
+    *misses = (unsigned long)cache_misses;
+}
+
 /*
  * Process a dynamic codes block.
  *
@@ -561,6 +827,8 @@ local int dynamic(struct state *s)
     int nlen, ndist, ncode;             /* number of lengths in descriptor */
     int index;                          /* index of lengths[] */
     int err;                            /* construct() return value */
+    size_t start;                       /* bit position of the header */
+    struct cache_entry *e;              /* cached tables for the header */
     uint16_t lengths[MAXCODES];         /* descriptor code lengths */
     uint16_t lencnt[MAXBITS + 1], lensym[MAXLCODES];      /* lencode memory */
     uint16_t distcnt[MAXBITS + 1], distsym[MAXDCODES];    /* distcode memory */
@@ -568,6 +836,12 @@ local int dynamic(struct state *s)
     static const uint16_t order[19] =   /* permutation of code length codes */
     { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
 
+    /* reuse the tables of an identical header if one was seen before */
+    e = cache_lookup(s);
+    if (e != NULL)
+        return codes(s, &e->lencode, &e->distcode);
+    start = bitpos(s);
+
     /* construct lencode and distcode */
     lencode.count = lencnt;
     lencode.symbol = lensym;
@@ -598,6 +872,8 @@ local int dynamic(struct state *s)
         int symbol;             /* decoded value */
         int len;                /* last length to repeat */
 
+        if (s->incnt > s->inlen)
+            return 2;           /* overran padded input */
         symbol = decode(s, &lencode);
         if (symbol < 0)
             return symbol;          /* invalid symbol */
@@ -635,6 +911,10 @@ local int dynamic(struct state *s)
     if (err && (err < 0 || ndist != distcode.count[0] + distcode.count[1]))
         return -8;      /* incomplete code ok only for single length 1 code */
 
+    /* remember the tables, unless the header overran padded input */
+    if (s->incnt <= s->inlen)
+        cache_store(s, start, &lencode, nlen, &distcode, ndist);
+
     /* decode data until end-of-block code */
     return codes(s, &lencode, &distcode);
 }
@@ -658,6 +938,7 @@ local int dynamic(struct state *s)
  *
  * The return codes are:
  *
+ *   3:  output consumer requested to stop (puff_stream() and puff_partial())
  *   2:  available inflate data did not terminate
  *   1:  output space exhausted before completing inflate
  *   0:  successful inflate
@@ -682,47 +963,258 @@ local int dynamic(struct state *s)
  *   block (if it was a fixed or dynamic block) are undefined and have no
  *   expected values to check.
  */
+/*
+ * Process blocks until the last block or an error.  With padded input, bits()
+ * and decode() may read past the end of the input, but never by more than
+ * PUFF_PAD bytes since the loops of dynamic() and codes() check for it, and
+ * any result obtained after doing so is replaced by the error puff() would
+ * have returned upon running out of input.
+ */
+local int inflate_blocks(struct state *s)
+{
+    int last, type;             /* block information */
+    int err;                    /* return value */
+
+    do {
+        last = bits(s, 1);              /* one if last block */
+        type = bits(s, 2);              /* block type 0..3 */
+        err = type == 0 ?
+            stored(s) :
+            (type == 1 ?
+                fixed(s) :
+                (type == 2 ?
+                    dynamic(s) :
+                    -1));               /* type == 3, invalid */
+        if (s->incnt > s->inlen)
+            return 2;                   /* overran padded input */
+        if (err == 0 && s->out != NIL)
+            err = emit(s);
+        if (err != 0)
+            break;                      /* return with error */
+    } while (!last);
+    return err;
+}
+
+local int blocks(struct state *s)
+{
+    /* return if bits() or decode() tries to read past available input */
+    if (setjmp(s->env) != 0)            /* if came back here via longjmp() */
+        return 2;                       /* then skip do-loop, return error */
+
+    return inflate_blocks(s);
+}
+
 int puff(size_t dictlen,        /* length of custom dictionary */
     uint8_t *dest,              /* pointer to destination pointer */
     size_t *destlen,            /* amount of output space */
     const uint8_t *source,      /* pointer to source data pointer */
     size_t *sourcelen)          /* amount of input available */
+{
+    return puff_sum(dictlen, dest, destlen, source, sourcelen, NULL, NULL);
+}
+
+/*
+ * Same as puff(), but also update *sum with checksum() over the data produced
+ * by each block, as soon as that block has been decoded, so that computing the
+ * checksum does not require an extra pass over the whole output.  The custom
+ * dictionary is not included in the checksum.  Nothing is computed if either
+ * checksum is NULL or dest is NIL.  *sum is only updated on success.
+ */
+int puff_sum(size_t dictlen,    /* length of custom dictionary */
+    uint8_t *dest,              /* pointer to destination pointer */
+    size_t *destlen,            /* amount of output space */
+    const uint8_t *source,      /* pointer to source data pointer */
+    size_t *sourcelen,          /* amount of input available */
+    puff_checksum checksum,     /* checksum function, or NULL */
+    uint32_t *sum)              /* running value of the checksum */
 {
     struct state s;             /* input/output state */
-    int last, type;             /* block information */
     int err;                    /* return value */
 
     /* initialize output state */
     s.out = dest;
     s.outlen = *destlen;                /* ignored if dest is NIL */
     s.outcnt = dictlen;
+    s.flush = NULL;
+    s.done = dictlen;
+    s.slid = 0;
+    s.partial = 0;
 
     /* initialize input state */
     s.in = source;
     s.inlen = *sourcelen;
+    s.inend = s.inlen;
     s.incnt = 0;
     s.bitbuf = 0;
     s.bitcnt = 0;
 
-    /* return if bits() or decode() tries to read past available input */
-    if (setjmp(s.env) != 0)             /* if came back here via longjmp() */
-        err = 2;                        /* then skip do-loop, return error */
-    else {
-        /* process blocks until last block or error */
-        do {
-            last = bits(&s, 1);         /* one if last block */
-            type = bits(&s, 2);         /* block type 0..3 */
-            err = type == 0 ?
-                stored(&s) :
-                (type == 1 ?
-                    fixed(&s) :
-                    (type == 2 ?
-                        dynamic(&s) :
-                        -1));           /* type == 3, invalid */
-            if (err != 0)
-                break;                  /* return with error */
-        } while (!last);
+    /* initialize checksum state */
+    s.checksum = (dest == NIL || sum == NULL) ? NULL : checksum;
+    s.sum = (s.checksum == NULL) ? 0 : *sum;
+
+    err = blocks(&s);
+
+    /* update the lengths and return */
+    if (err <= 0) {
+        *destlen = s.outcnt - dictlen;
+        *sourcelen = s.incnt;
+    }
+    if (err == 0 && s.checksum != NULL)
+        *sum = s.sum;
+    return err;
+}
+
+/*
+ * Inflate source through a sliding window of windowlen bytes, which must be
+ * at least PUFF_MIN_WINDOW, handing the output over to flush() as it is
+ * produced, in chunks that are never larger than the window.  This allows
+ * the decompression of data of any size with a fixed amount of memory.  If
+ * flush() returns non-zero, inflation stops with a return value of 3.
+ * checksum, if not NULL, is applied to the output in the same manner as
+ * puff_sum().  On return, destlen is set to the total amount of output that
+ * was produced, and sourcelen to the amount of input consumed, including for
+ * a return value of 3.
+ */
+int puff_stream(uint8_t *window,    /* sliding window */
+    size_t windowlen,           /* size of the sliding window */
+    size_t *destlen,            /* total amount of output produced */
+    const uint8_t *source,      /* pointer to source data pointer */
+    size_t *sourcelen,          /* amount of input available */
+    puff_flush flush,           /* output consumer */
+    void *opaque,               /* output consumer context */
+    puff_checksum checksum,     /* checksum function, or NULL */
+    uint32_t *sum)              /* running value of the checksum */
+{
+    struct state s;             /* input/output state */
+    int err;                    /* return value */
+
+    if (window == NIL || windowlen < PUFF_MIN_WINDOW || flush == NULL)
+        return 1;
+
+    /* initialize output state */
+    s.out = window;
+    s.outlen = windowlen;
+    s.outcnt = 0;
+    s.flush = flush;
+    s.opaque = opaque;
+    s.done = 0;
+    s.slid = 0;
+    s.partial = 0;
+
+    /* initialize input state */
+    s.in = source;
+    s.inlen = *sourcelen;
+    s.inend = s.inlen;
+    s.incnt = 0;
+    s.bitbuf = 0;
+    s.bitcnt = 0;
+
+    /* initialize checksum state */
+    s.checksum = (sum == NULL) ? NULL : checksum;
+    s.sum = (s.checksum == NULL) ? 0 : *sum;
+
+    err = blocks(&s);
+
+    /* update the lengths and return */
+    if (err <= 0 || err == 3) {
+        *destlen = s.slid + s.outcnt;
+        *sourcelen = s.incnt;
+    }
+    if (err == 0 && s.checksum != NULL)
+        *sum = s.sum;
+    return err;
+}
+
+/*
+ * Same as puff(), but stop as soon as at least need bytes of output have been
+ * produced, which avoids decoding the whole stream when only its beginning is
+ * of interest.  On an early stop, the return value is 3, and destlen and
+ * sourcelen are updated as on success.  If the stream terminates before need
+ * bytes are produced, this behaves exactly as puff().  Since decoding stops
+ * at the first literal or match that does not fit, up to MAXMATCH - 1 bytes
+ * more than need may be produced, so dest should have room for them.
+ */
+int puff_partial(size_t dictlen,    /* length of custom dictionary */
+    uint8_t *dest,              /* pointer to destination pointer */
+    size_t *destlen,            /* amount of output space */
+    const uint8_t *source,      /* pointer to source data pointer */
+    size_t *sourcelen,          /* amount of input available */
+    size_t need)                /* amount of output required */
+{
+    struct state s;             /* input/output state */
+    int err;                    /* return value */
+
+    if (dest == NIL)
+        return 1;
+
+    /* initialize output state */
+    s.out = dest;
+    s.outlen = dictlen + need + MAXMATCH - 1;
+    if (s.outlen > *destlen)
+        s.outlen = *destlen;
+    s.outcnt = dictlen;
+    s.flush = NULL;
+    s.done = dictlen;
+    s.slid = 0;
+    s.partial = 1;
+    s.checksum = NULL;
+
+    /* initialize input state */
+    s.in = source;
+    s.inlen = *sourcelen;
+    s.inend = s.inlen;
+    s.incnt = 0;
+    s.bitbuf = 0;
+    s.bitcnt = 0;
+
+    err = blocks(&s);
+    if (err == 3 && s.outcnt - dictlen < need)
+        err = 1;                        /* not enough output space */
+
+    /* update the lengths and return */
+    if (err <= 0 || err == 3) {
+        *destlen = s.outcnt - dictlen;
+        *sourcelen = s.incnt;
     }
+    return err;
+}
+
+/*
+ * Same as puff(), but without setjmp() and longjmp(), which are a significant
+ * part of the cost of inflating very small streams such as zRIFs.  For this,
+ * the caller must guarantee that at least PUFF_PAD bytes can be read past the
+ * end of source (their value does not matter), so that input does not need to
+ * be checked each time bits() or decode() fetch a byte.  The return values and
+ * the updated lengths are the same as the ones from puff().
+ */
+int puff_padded(size_t dictlen, /* length of custom dictionary */
+    uint8_t *dest,              /* pointer to destination pointer */
+    size_t *destlen,            /* amount of output space */
+    const uint8_t *source,      /* pointer to padded source data */
+    size_t *sourcelen)          /* amount of input available, minus padding */
+{
+    struct state s;             /* input/output state */
+    int err;                    /* return value */
+
+    /* initialize output state */
+    s.out = dest;
+    s.outlen = *destlen;                /* ignored if dest is NIL */
+    s.outcnt = dictlen;
+    s.flush = NULL;
+    s.done = dictlen;
+    s.slid = 0;
+    s.partial = 0;
+    s.checksum = NULL;
+
+    /* initialize input state, with no limit for bits() and decode() */
+    s.in = source;
+    s.inlen = *sourcelen;
+    s.inend = (size_t)-1;
+    s.incnt = 0;
+    s.bitbuf = 0;
+    s.bitcnt = 0;
+
+    err = inflate_blocks(&s);
 
     /* update the lengths and return */
     if (err <= 0) {
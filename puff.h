@@ -34,8 +34,57 @@
 #  define NIL ((unsigned char *)0)      /* for no output option */
 #endif
 
+/* smallest sliding window for puff_stream(): maximum distance + maximum length */
+#define PUFF_MIN_WINDOW (32768 + 258)
+
+/* extra output space that allows matches to be copied 16 bytes at a time */
+#define PUFF_SLACK 16
+
+/* readable bytes that must follow the input of puff_padded() */
+#define PUFF_PAD 16
+
 int puff(size_t dictlen,          /* length of custom dictionary */
          uint8_t *dest,           /* pointer to destination pointer */
          size_t *destlen,         /* amount of output space */
          const uint8_t *source,   /* pointer to source data pointer */
          size_t *sourcelen);      /* amount of input available */
+
+/* Running checksum (CRC-32, Adler-32...) to be updated as output is produced */
+typedef uint32_t (*puff_checksum)(uint32_t sum, const uint8_t *data, size_t len);
+
+int puff_sum(size_t dictlen,      /* length of custom dictionary */
+         uint8_t *dest,           /* pointer to destination pointer */
+         size_t *destlen,         /* amount of output space */
+         const uint8_t *source,   /* pointer to source data pointer */
+         size_t *sourcelen,       /* amount of input available */
+         puff_checksum checksum,  /* checksum function, or NULL */
+         uint32_t *sum);          /* running value of the checksum */
+
+/* Output consumer for puff_stream(), returning non-zero to stop inflating */
+typedef int (*puff_flush)(void *opaque, const uint8_t *data, size_t len);
+
+int puff_stream(uint8_t *window,  /* sliding window */
+         size_t windowlen,        /* size of the sliding window */
+         size_t *destlen,         /* total amount of output produced */
+         const uint8_t *source,   /* pointer to source data pointer */
+         size_t *sourcelen,       /* amount of input available */
+         puff_flush flush,        /* output consumer */
+         void *opaque,            /* output consumer context */
+         puff_checksum checksum,  /* checksum function, or NULL */
+         uint32_t *sum);          /* running value of the checksum */
+
+int puff_partial(size_t dictlen,  /* length of custom dictionary */
+         uint8_t *dest,           /* pointer to destination pointer */
+         size_t *destlen,         /* amount of output space */
+         const uint8_t *source,   /* pointer to source data pointer */
+         size_t *sourcelen,       /* amount of input available */
+         size_t need);            /* amount of output required */
+
+int puff_padded(size_t dictlen,   /* length of custom dictionary */
+         uint8_t *dest,           /* pointer to destination pointer */
+         size_t *destlen,         /* amount of output space */
+         const uint8_t *source,   /* pointer to padded source data */
+         size_t *sourcelen);      /* amount of input available, minus padding */
+
+/* Hits and misses of the dynamic block table cache, summed over all threads */
+void puff_cache_stats(unsigned long *hits, unsigned long *misses);
@@ -0,0 +1,301 @@
+/*
+  Vitali - Vita License database updater
+  Copyright © 2017-2018 - VitaSmith
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32)
+#include <windows.h>
+#elif !defined(__vita__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "rifcache.h"
+
+#define FNV64_OFFSET        0xcbf29ce484222325ULL
+#define FNV64_PRIME         0x100000001b3ULL
+#define XXH64_PRIME2        0xc2b2ae3d27d4eb4fULL
+#define XXH64_PRIME3        0x165667b19e3779f9ULL
+#define MIN_RIF_SIZE        512
+#define MAX_RIF_SIZE        1024
+
+uint64_t rif_cache_hash(const uint8_t* data, size_t size)
+{
+    uint64_t h = FNV64_OFFSET ^ (uint64_t)size, w;
+    size_t i;
+
+    /*
+     * A multiplication only carries upwards, so without the shift, the high
+     * bytes of each word would only ever reach the top bits of the hash
+     */
+    for (i = 0; i + sizeof(w) <= size; i += sizeof(w)) {
+        memcpy(&w, &data[i], sizeof(w));
+        h = (h ^ w) * FNV64_PRIME;
+        h ^= h >> 29;
+    }
+    for (; i < size; i++)
+        h = (h ^ data[i]) * FNV64_PRIME;
+    /* Same final avalanche as xxHash64 */
+    h ^= h >> 33;
+    h *= XXH64_PRIME2;
+    h ^= h >> 29;
+    h *= XXH64_PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+/* Make sure that the mapped file is complete and that every entry is within bounds */
+static bool validate(rif_cache* cache, uint64_t source_size, uint64_t source_hash)
+{
+    const rif_cache_header* hdr = (const rif_cache_header*)cache->base;
+    uint64_t index_end;
+
+    if ((cache->size < sizeof(rif_cache_header)) ||
+        (memcmp(hdr->magic, RIF_CACHE_MAGIC, sizeof(hdr->magic)) != 0) ||
+        (hdr->version != RIF_CACHE_VERSION) ||
+        (hdr->source_size != source_size) || (hdr->source_hash != source_hash))
+        return false;
+    index_end = sizeof(rif_cache_header) + (uint64_t)hdr->count * sizeof(rif_cache_entry);
+    if (index_end + hdr->data_size != cache->size)
+        return false;
+    cache->count = hdr->count;
+    cache->index = (const rif_cache_entry*)&cache->base[sizeof(rif_cache_header)];
+    cache->data = &cache->base[index_end];
+    for (uint32_t i = 0; i < cache->count; i++) {
+        const rif_cache_entry* e = &cache->index[i];
+        if ((e->content_id[sizeof(e->content_id) - 1] != 0) ||
+            ((e->size != MIN_RIF_SIZE) && (e->size != MAX_RIF_SIZE)) ||
+            (e->offset > hdr->data_size) || (e->size > hdr->data_size - e->offset))
+            return false;
+    }
+    return true;
+}
+
+bool rif_cache_open(rif_cache* cache, const char* path, uint64_t source_size, uint64_t source_hash)
+{
+    memset(cache, 0, sizeof(*cache));
+#if defined(_WIN32)
+    LARGE_INTEGER size;
+    cache->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (cache->file == INVALID_HANDLE_VALUE) {
+        cache->file = NULL;
+        return false;
+    }
+    if (!GetFileSizeEx(cache->file, &size) || (size.QuadPart == 0) || ((uint64_t)size.QuadPart > SIZE_MAX))
+        goto fail;
+    cache->size = (size_t)size.QuadPart;
+    cache->mapping = CreateFileMappingA(cache->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (cache->mapping == NULL)
+        goto fail;
+    cache->base = MapViewOfFile(cache->mapping, FILE_MAP_READ, 0, 0, 0);
+#elif defined(__vita__)
+    /* No mmap() on the Vita, so we read the whole file instead */
+    FILE* fd = fopen(path, "rb");
+    long size;
+    uint8_t* buf;
+    if (fd == NULL)
+        return false;
+    fseek(fd, 0, SEEK_END);
+    size = ftell(fd);
+    fseek(fd, 0, SEEK_SET);
+    buf = (size > 0) ? malloc(size) : NULL;
+    if ((buf != NULL) && (fread(buf, 1, size, fd) != (size_t)size)) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(fd);
+    cache->base = buf;
+    cache->size = (size_t)size;
+#else
+    struct stat st;
+    void* map;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    if ((fstat(fd, &st) != 0) || (st.st_size == 0) || ((uint64_t)st.st_size > SIZE_MAX)) {
+        close(fd);
+        return false;
+    }
+    cache->size = (size_t)st.st_size;
+    map = mmap(NULL, cache->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+    cache->base = map;
+#endif
+    if ((cache->base != NULL) && validate(cache, source_size, source_hash))
+        return true;
+#if defined(_WIN32)
+fail:
+#endif
+    rif_cache_close(cache);
+    return false;
+}
+
+void rif_cache_close(rif_cache* cache)
+{
+#if defined(_WIN32)
+    if (cache->base != NULL)
+        UnmapViewOfFile(cache->base);
+    if (cache->mapping != NULL)
+        CloseHandle(cache->mapping);
+    if (cache->file != NULL)
+        CloseHandle(cache->file);
+#elif defined(__vita__)
+    free((void*)cache->base);
+#else
+    if (cache->base != NULL)
+        munmap((void*)cache->base, cache->size);
+#endif
+    memset(cache, 0, sizeof(*cache));
+}
+
+const uint8_t* rif_cache_find(const rif_cache* cache, const char* content_id, size_t* rif_len)
+{
+    uint32_t lo = 0, hi = cache->count;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int r = strncmp(content_id, cache->index[mid].content_id, RIF_CONTENT_ID_MAX);
+        if (r == 0)
+            return rif_cache_rif(cache, mid, rif_len);
+        if (r < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return NULL;
+}
+
+rif_cache_writer* rif_cache_writer_create(void)
+{
+    return calloc(1, sizeof(rif_cache_writer));
+}
+
+bool rif_cache_add(rif_cache_writer* writer, const uint8_t* rif, size_t rif_len)
+{
+    const char* content_id = rif_content_id(rif);
+    rif_cache_entry* e;
+
+    if (((rif_len != MIN_RIF_SIZE) && (rif_len != MAX_RIF_SIZE)) ||
+        (strnlen(content_id, RIF_CONTENT_ID_MAX) >= RIF_CONTENT_ID_MAX))
+        return false;
+    if (writer->count >= writer->max_count) {
+        uint32_t max_count = (writer->max_count == 0) ? 4096 : 2 * writer->max_count;
+        e = realloc(writer->index, max_count * sizeof(rif_cache_entry));
+        if (e == NULL)
+            return false;
+        writer->index = e;
+        writer->max_count = max_count;
+    }
+    if (writer->data_size + rif_len > writer->max_data_size) {
+        size_t max_data_size = (writer->max_data_size == 0) ? 4096 * MIN_RIF_SIZE : 2 * writer->max_data_size;
+        uint8_t* data = realloc(writer->data, max_data_size);
+        if (data == NULL)
+            return false;
+        writer->data = data;
+        writer->max_data_size = max_data_size;
+    }
+    e = &writer->index[writer->count++];
+    memset(e, 0, sizeof(*e));
+    strcpy(e->content_id, content_id);
+    e->offset = writer->data_size;
+    e->size = (uint32_t)rif_len;
+    memcpy(&writer->data[writer->data_size], rif, rif_len);
+    writer->data_size += rif_len;
+    return true;
+}
+
+/* Offsets only ever grow, so using them to break ties keeps the first of any duplicates first */
+static int compare_entries(const void* a, const void* b)
+{
+    const rif_cache_entry* ea = (const rif_cache_entry*)a;
+    const rif_cache_entry* eb = (const rif_cache_entry*)b;
+    int r = strncmp(ea->content_id, eb->content_id, RIF_CONTENT_ID_MAX);
+    if (r != 0)
+        return r;
+    return (ea->offset < eb->offset) ? -1 : (ea->offset > eb->offset);
+}
+
+bool rif_cache_write(rif_cache_writer* writer, const char* path, uint64_t source_size, uint64_t source_hash)
+{
+    rif_cache_header hdr;
+    uint32_t i, count = 0;
+    uint64_t offset = 0, *src_offset = NULL;
+    FILE* fd = NULL;
+    bool r = false;
+
+    if (writer->count != 0)
+        qsort(writer->index, writer->count, sizeof(rif_cache_entry), compare_entries);
+    /* Drop duplicates and lay the data out in index order */
+    src_offset = malloc((writer->count + 1) * sizeof(uint64_t));
+    if (src_offset == NULL)
+        goto out;
+    for (i = 0; i < writer->count; i++) {
+        if ((count != 0) && (strncmp(writer->index[count - 1].content_id,
+            writer->index[i].content_id, RIF_CONTENT_ID_MAX) == 0))
+            continue;
+        writer->index[count] = writer->index[i];
+        src_offset[count] = writer->index[i].offset;
+        writer->index[count].offset = offset;
+        offset += writer->index[i].size;
+        count++;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, RIF_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.version = RIF_CACHE_VERSION;
+    hdr.count = count;
+    hdr.source_size = source_size;
+    hdr.source_hash = source_hash;
+    hdr.data_size = offset;
+
+    fd = fopen(path, "wb");
+    if ((fd == NULL) || (fwrite(&hdr, sizeof(hdr), 1, fd) != 1) ||
+        ((count != 0) && (fwrite(writer->index, sizeof(rif_cache_entry), count, fd) != count)))
+        goto out;
+    for (i = 0; i < count; i++) {
+        if (fwrite(&writer->data[src_offset[i]], writer->index[i].size, 1, fd) != 1)
+            goto out;
+    }
+    r = true;
+
+out:
+    /* A partial file is rejected by rif_cache_open(), but there's no point in keeping it */
+    if ((fd != NULL) && ((fclose(fd) != 0) || !r)) {
+        remove(path);
+        r = false;
+    }
+    free(src_offset);
+    writer->count = 0;
+    writer->data_size = 0;
+    return r;
+}
+
+void rif_cache_writer_free(rif_cache_writer* writer)
+{
+    if (writer == NULL)
+        return;
+    free(writer->index);
+    free(writer->data);
+    free(writer);
+}
@@ -0,0 +1,103 @@
+/*
+  Vitali - Vita License database updater
+  Copyright © 2017-2018 - VitaSmith
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Cache of decoded RIFs, so that rebuilding a database from the same source
+ * needs neither base64 nor inflate. The file is laid out so that it can be
+ * used in place once mapped:
+ *   rif_cache_header
+ *   rif_cache_entry[count], sorted by CONTENT_ID
+ *   RIF data, in the same order as the entries
+ * All values are in native byte order, as the cache is never shared.
+ */
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "zrif.h"
+
+#define RIF_CACHE_MAGIC     "VITALIRC"
+#define RIF_CACHE_VERSION   3
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    /* Size and rif_cache_hash() of the key of the source the RIFs were decoded from */
+    uint64_t source_size;
+    uint64_t source_hash;
+    uint64_t data_size;
+    uint64_t reserved;
+} rif_cache_header;
+
+typedef struct {
+    char content_id[RIF_CONTENT_ID_MAX];    /* NUL padded */
+    uint64_t offset;                        /* from the start of the RIF data */
+    uint32_t size;
+    uint32_t reserved;
+} rif_cache_entry;
+
+/* A cache file, opened for reading */
+typedef struct {
+    const uint8_t* base;
+    size_t size;
+    uint32_t count;
+    const rif_cache_entry* index;
+    const uint8_t* data;
+#if defined(_WIN32)
+    void* file;
+    void* mapping;
+#endif
+} rif_cache;
+
+/* RIFs being collected, to be written as a cache file */
+typedef struct {
+    rif_cache_entry* index;
+    uint8_t* data;
+    uint32_t count, max_count;
+    size_t data_size, max_data_size;
+} rif_cache_writer;
+
+/* 64-bit FNV-1a over 64-bit words, mixed after each word, of the source data */
+uint64_t rif_cache_hash(const uint8_t* data, size_t size);
+
+/*
+ * Map the cache file at path, provided that it is valid and was created from
+ * a source with the same size and hash. Returns false otherwise.
+ */
+bool rif_cache_open(rif_cache* cache, const char* path, uint64_t source_size, uint64_t source_hash);
+void rif_cache_close(rif_cache* cache);
+/* Binary search for CONTENT_ID. Returns NULL if not found */
+const uint8_t* rif_cache_find(const rif_cache* cache, const char* content_id, size_t* rif_len);
+
+static inline const uint8_t* rif_cache_rif(const rif_cache* cache, uint32_t i, size_t* rif_len)
+{
+    *rif_len = cache->index[i].size;
+    return &cache->data[cache->index[i].offset];
+}
+
+rif_cache_writer* rif_cache_writer_create(void);
+bool rif_cache_add(rif_cache_writer* writer, const uint8_t* rif, size_t rif_len);
+/*
+ * Sort the RIFs by CONTENT_ID, dropping all but the first of any duplicates,
+ * and write them to path.
+ */
+bool rif_cache_write(rif_cache_writer* writer, const char* path, uint64_t source_size, uint64_t source_hash);
+void rif_cache_writer_free(rif_cache_writer* writer);
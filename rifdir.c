@@ -0,0 +1,444 @@
+/*
+  Vitali - Vita License database updater
+  Copyright © 2017-2018 - VitaSmith
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32)
+#include <windows.h>
+#include <direct.h>
+#include <io.h>
+#include <fcntl.h>
+#define mkdir(path, mode)   _mkdir(path)
+#elif defined(__vita__)
+#include <psp2/io/dirent.h>
+#include <psp2/io/fcntl.h>
+#include <psp2/io/stat.h>
+#define _open(path, flags)  sceIoOpen(path, flags, 0)
+#define _read               sceIoRead
+#define _close              sceIoClose
+#define _O_RDONLY           SCE_O_RDONLY
+#define _O_BINARY           0
+#define mkdir               sceIoMkdir
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#define _open               open
+#define _read               read
+#define _close              close
+#define _O_RDONLY           O_RDONLY
+#define _O_BINARY           0
+#endif
+
+#include "rifdir.h"
+#include "thread.h"
+
+/* Paths of the entries of a directory, as collected by a worker */
+typedef struct {
+    char** item;
+    uint32_t count, max_count;
+} path_list;
+
+typedef struct {
+    char* path;
+    path_list dirs, files;
+    bool ok;
+} dir_node;
+
+typedef struct {
+    dir_node* nodes;
+    size_t nb_nodes;
+    volatile long next;
+} walk_job;
+
+typedef struct {
+    const rif_dir* dir;
+    uint32_t first;
+    rif_dir_batch* batch;
+} read_job;
+
+/* The RIFs of a batch that share a TITLE_ID, which are handed to workers as a group */
+typedef struct {
+    const char* path;
+    rif_dir_batch* batch;
+    uint32_t group[RIF_DIR_BATCH_SIZE + 1];
+    size_t nb_groups;
+    volatile long next;
+} write_job;
+
+static bool push_path(path_list* list, char* path)
+{
+    if (path == NULL)
+        return false;
+    if (list->count >= list->max_count) {
+        uint32_t max_count = (list->max_count == 0) ? 16 : 2 * list->max_count;
+        char** item = realloc(list->item, max_count * sizeof(char*));
+        if (item == NULL) {
+            free(path);
+            return false;
+        }
+        list->item = item;
+        list->max_count = max_count;
+    }
+    list->item[list->count++] = path;
+    return true;
+}
+
+static void free_paths(path_list* list)
+{
+    for (uint32_t i = 0; i < list->count; i++)
+        free(list->item[i]);
+    free(list->item);
+    memset(list, 0, sizeof(*list));
+}
+
+static char* join_path(const char* dir, const char* name)
+{
+    size_t dir_len = strlen(dir), name_len = strlen(name);
+    char* path = malloc(dir_len + name_len + 2);
+
+    if (path == NULL)
+        return NULL;
+    memcpy(path, dir, dir_len);
+    /* Don't double the separator of "ux0:license/" or "/" */
+    if ((dir_len != 0) && (dir[dir_len - 1] != '/') && (dir[dir_len - 1] != '\\'))
+        path[dir_len++] = '/';
+    memcpy(&path[dir_len], name, name_len + 1);
+    return path;
+}
+
+/* File systems are case insensitive on Windows and the Vita, so "*.RIF" is accepted everywhere */
+static bool is_rif_name(const char* name)
+{
+    size_t len = strlen(name);
+
+    return (len > 4) && (name[len - 4] == '.') && ((name[len - 3] | 0x20) == 'r') &&
+        ((name[len - 2] | 0x20) == 'i') && ((name[len - 1] | 0x20) == 'f');
+}
+
+static int compare_paths(const void* a, const void* b)
+{
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+/* Add an entry of node to its subdirectories or its files, depending on its type */
+static bool add_entry(dir_node* node, const char* name, bool is_dir, bool is_file)
+{
+    if ((strcmp(name, ".") == 0) || (strcmp(name, "..") == 0))
+        return true;
+    if (is_dir)
+        return push_path(&node->dirs, join_path(node->path, name));
+    if (is_file && is_rif_name(name))
+        return push_path(&node->files, join_path(node->path, name));
+    return true;
+}
+
+static void list_dir(dir_node* node)
+{
+    bool ok = true;
+#if defined(_WIN32)
+    WIN32_FIND_DATAA fd;
+    char* pattern = join_path(node->path, "*");
+    HANDLE h = (pattern == NULL) ? INVALID_HANDLE_VALUE : FindFirstFileA(pattern, &fd);
+
+    free(pattern);
+    if (h == INVALID_HANDLE_VALUE)
+        return;
+    do {
+        /* Junctions and symbolic links to directories are not followed */
+        bool is_dir = (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        if (is_dir && (fd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+            continue;
+        ok = add_entry(node, fd.cFileName, is_dir, !is_dir);
+    } while (ok && FindNextFileA(h, &fd));
+    FindClose(h);
+#elif defined(__vita__)
+    SceIoDirent ent;
+    SceUID fd = sceIoDopen(node->path);
+
+    if (fd < 0)
+        return;
+    memset(&ent, 0, sizeof(ent));
+    while (ok && (sceIoDread(fd, &ent) > 0))
+        ok = add_entry(node, ent.d_name, SCE_S_ISDIR(ent.d_stat.st_mode), SCE_S_ISREG(ent.d_stat.st_mode));
+    sceIoDclose(fd);
+#else
+    struct dirent* ent;
+    struct stat st;
+    DIR* d = opendir(node->path);
+
+    if (d == NULL)
+        return;
+    while (ok && ((ent = readdir(d)) != NULL)) {
+        bool is_dir = (ent->d_type == DT_DIR), is_file = (ent->d_type == DT_REG);
+        /* Symbolic links to files are followed, but not those to directories */
+        if ((ent->d_type == DT_UNKNOWN) || (ent->d_type == DT_LNK)) {
+            char* path = join_path(node->path, ent->d_name);
+            is_dir = (path != NULL) && (lstat(path, &st) == 0) && S_ISDIR(st.st_mode);
+            is_file = (path != NULL) && (stat(path, &st) == 0) && S_ISREG(st.st_mode);
+            free(path);
+        }
+        ok = add_entry(node, ent->d_name, is_dir, is_file);
+    }
+    closedir(d);
+#endif
+    if (!ok)
+        return;
+    /* Directories are not listed in any particular order */
+    if (node->dirs.count > 1)
+        qsort(node->dirs.item, node->dirs.count, sizeof(char*), compare_paths);
+    if (node->files.count > 1)
+        qsort(node->files.item, node->files.count, sizeof(char*), compare_paths);
+    node->ok = true;
+}
+
+static THREAD_FUNC(walk_worker)
+{
+    walk_job* job = (walk_job*)arg;
+    long i;
+
+    while ((i = atomic_add(&job->next, 1)) < (long)job->nb_nodes)
+        list_dir(&job->nodes[i]);
+    THREAD_RETURN;
+}
+
+/* Run func over the items of job with up to max_workers threads, the calling thread included */
+static void run_workers(thread_func func, void* job, size_t nb_items, size_t max_workers)
+{
+    thread_t threads[RIF_DIR_MAX_WORKERS];
+    size_t i, nb_threads;
+
+    if ((max_workers == 0) || (max_workers > RIF_DIR_MAX_WORKERS))
+        max_workers = RIF_DIR_MAX_WORKERS;
+    if (max_workers > nb_items)
+        max_workers = nb_items;
+    for (nb_threads = 0; nb_threads + 1 < max_workers; nb_threads++) {
+        if (!thread_create(&threads[nb_threads], func, job))
+            break;
+    }
+    func(job);
+    for (i = 0; i < nb_threads; i++)
+        thread_join(threads[i]);
+}
+
+bool rif_dir_exists(const char* path)
+{
+#if defined(_WIN32)
+    DWORD attr = GetFileAttributesA(path);
+    return (attr != INVALID_FILE_ATTRIBUTES) && (attr & FILE_ATTRIBUTE_DIRECTORY);
+#elif defined(__vita__)
+    SceIoStat st;
+    return (sceIoGetstat(path, &st) >= 0) && SCE_S_ISDIR(st.st_mode);
+#else
+    struct stat st;
+    return (stat(path, &st) == 0) && S_ISDIR(st.st_mode);
+#endif
+}
+
+bool rif_dir_list(rif_dir* dir, const char* path, size_t max_workers)
+{
+    path_list level = { NULL, 0, 0 }, next = { NULL, 0, 0 }, files = { NULL, 0, 0 };
+    walk_job job;
+    const char* path_root;
+    bool r = false;
+    size_t i;
+    uint32_t j;
+
+    memset(dir, 0, sizeof(*dir));
+    if (!push_path(&level, strdup(path)))
+        return false;
+    path_root = level.item[0];
+    while (level.count != 0) {
+        job.nodes = calloc(level.count, sizeof(dir_node));
+        if (job.nodes == NULL)
+            goto out;
+        job.nb_nodes = level.count;
+        job.next = 0;
+        for (i = 0; i < job.nb_nodes; i++)
+            job.nodes[i].path = level.item[i];
+        run_workers(walk_worker, &job, job.nb_nodes, max_workers);
+
+        /* Merge the results in order, so that the listing doesn't depend on the scheduling */
+        r = true;
+        for (i = 0; i < job.nb_nodes; i++) {
+            dir_node* node = &job.nodes[i];
+            if (!node->ok) {
+                /* A tree that can't be read at all is an error, whereas a subdirectory is skipped */
+                if (node->path == path_root)
+                    r = false;
+                dir->unreadable++;
+            }
+            for (j = 0; r && (j < node->dirs.count); j++) {
+                r = push_path(&next, node->dirs.item[j]);
+                node->dirs.item[j] = NULL;
+            }
+            for (j = 0; r && (j < node->files.count); j++) {
+                r = push_path(&files, node->files.item[j]);
+                node->files.item[j] = NULL;
+            }
+            free_paths(&node->dirs);
+            free_paths(&node->files);
+        }
+        free(job.nodes);
+        free_paths(&level);
+        level = next;
+        memset(&next, 0, sizeof(next));
+        if (!r)
+            goto out;
+    }
+    dir->path = files.item;
+    dir->count = files.count;
+    dir->max_count = files.max_count;
+    memset(&files, 0, sizeof(files));
+
+out:
+    free_paths(&level);
+    free_paths(&next);
+    free_paths(&files);
+    if (!r)
+        dir->unreadable = 0;
+    return r;
+}
+
+/* Read a whole file, provided that it is no larger than a RIF. Returns its size or -1 */
+static int read_rif(const char* path, uint8_t* buf)
+{
+    uint8_t extra;
+    int len = 0, n;
+    int fd = _open(path, _O_RDONLY | _O_BINARY);
+
+    if (fd < 0)
+        return -1;
+    while ((len < RIF_MAX_SIZE) && ((n = (int)_read(fd, &buf[len], RIF_MAX_SIZE - len)) > 0))
+        len += n;
+    /* Anything past RIF_MAX_SIZE makes it too large, which check_rif() reports as a size error */
+    if ((n >= 0) && (len == RIF_MAX_SIZE) && ((n = (int)_read(fd, &extra, 1)) > 0))
+        len++;
+    _close(fd);
+    return (n < 0) ? -1 : len;
+}
+
+static THREAD_FUNC(read_worker)
+{
+    read_job* job = (read_job*)arg;
+    rif_dir_batch* batch = job->batch;
+    long i;
+    int len;
+
+    while ((i = atomic_add(&batch->next, 1)) < (long)batch->count) {
+        batch->path[i] = job->dir->path[job->first + i];
+        len = read_rif(batch->path[i], batch->rif[i]);
+        if (len < 0) {
+            batch->size[i] = 0;
+            batch->status[i] = RIF_DIR_ERR_READ;
+        } else {
+            batch->size[i] = (len > RIF_MAX_SIZE) ? 0 : (uint16_t)len;
+            batch->status[i] = check_rif(batch->rif[i], (size_t)len);
+        }
+    }
+    THREAD_RETURN;
+}
+
+void rif_dir_read(const rif_dir* dir, uint32_t first, rif_dir_batch* batch, size_t max_workers)
+{
+    read_job job = { dir, first, batch };
+
+    batch->count = (first >= dir->count) ? 0 : dir->count - first;
+    if (batch->count > RIF_DIR_BATCH_SIZE)
+        batch->count = RIF_DIR_BATCH_SIZE;
+    batch->next = 0;
+    if (batch->count != 0)
+        run_workers(read_worker, &job, batch->count, max_workers);
+}
+
+void rif_dir_free(rif_dir* dir)
+{
+    for (uint32_t i = 0; i < dir->count; i++)
+        free(dir->path[i]);
+    free(dir->path);
+    memset(dir, 0, sizeof(*dir));
+}
+
+bool rif_dir_create(const char* path)
+{
+    return (mkdir(path, 0777) == 0) || rif_dir_exists(path);
+}
+
+/* TITLE_ID is the 9 characters after the "UP0000-" of CONTENT_ID */
+static const char* title_id(const uint8_t* rif)
+{
+    return &rif_content_id(rif)[7];
+}
+
+static bool write_rif(const char* path, const uint8_t* rif, size_t rif_len)
+{
+    FILE* fd = fopen(path, "wb");
+    bool r;
+
+    if (fd == NULL)
+        return false;
+    r = (fwrite(rif, 1, rif_len, fd) == rif_len);
+    /* Don't leave a truncated license behind, as it would be taken for a valid one */
+    if ((fclose(fd) != 0) || !r) {
+        remove(path);
+        return false;
+    }
+    return true;
+}
+
+static THREAD_FUNC(write_worker)
+{
+    write_job* job = (write_job*)arg;
+    rif_dir_batch* batch = job->batch;
+    char path[512];
+    long g;
+    uint32_t i;
+    bool dir_ok;
+
+    while ((g = atomic_add(&job->next, 1)) < (long)job->nb_groups) {
+        i = job->group[g];
+        snprintf(path, sizeof(path), "%s/%.9s", job->path, title_id(batch->rif[i]));
+        dir_ok = rif_dir_create(path);
+        for (; i < job->group[g + 1]; i++) {
+            snprintf(path, sizeof(path), "%s/%.9s/%s.rif", job->path, title_id(batch->rif[i]),
+                rif_content_id(batch->rif[i]));
+            batch->status[i] = (dir_ok && write_rif(path, batch->rif[i], batch->size[i])) ? ZRIF_OK : RIF_DIR_ERR_WRITE;
+        }
+    }
+    THREAD_RETURN;
+}
+
+void rif_dir_write(const char* path, rif_dir_batch* batch, size_t max_workers)
+{
+    write_job job;
+    uint32_t i;
+
+    job.path = path;
+    job.batch = batch;
+    job.nb_groups = 0;
+    job.next = 0;
+    for (i = 0; i < batch->count; i++) {
+        if ((i == 0) || (memcmp(title_id(batch->rif[i]), title_id(batch->rif[i - 1]), 9) != 0))
+            job.group[job.nb_groups++] = i;
+    }
+    job.group[job.nb_groups] = batch->count;
+    if (job.nb_groups != 0)
+        run_workers(write_worker, &job, job.nb_groups, max_workers);
+}
@@ -0,0 +1,91 @@
+/*
+  Vitali - Vita License database updater
+  Copyright © 2017-2018 - VitaSmith
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Collection of the raw .rif license files found under a directory, such as
+ * the license/app/<TITLE_ID>/ and license/addcont/<TITLE_ID>/<ENTITLEMENT>/
+ * trees that VitaShell and NoNpDrm use. The tree is walked one level at a time,
+ * with the directories of each level spread over several workers, and the
+ * files are then read and validated concurrently, a batch at a time. RIFs can
+ * also be written out as such a tree, in the same manner.
+ */
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "zrif.h"
+
+/* Listing and reading files is bound by I/O rather than CPU, so this is also the default */
+#define RIF_DIR_MAX_WORKERS     8
+/* Number of files that are read concurrently, before being handed over */
+#define RIF_DIR_BATCH_SIZE      1024
+#define RIF_MAX_SIZE            1024
+/* Status of a file that could not be read or written, besides the ZRIF_xxx of check_rif() */
+#define RIF_DIR_ERR_READ        (-1)
+#define RIF_DIR_ERR_WRITE       (-2)
+
+/* The .rif files of a tree, sorted by name within each directory, shallowest first */
+typedef struct {
+    char** path;
+    uint32_t count, max_count;
+    uint32_t unreadable;                    /* subdirectories that could not be listed */
+} rif_dir;
+
+typedef struct {
+    volatile long next;
+    uint32_t count;
+    const char* path[RIF_DIR_BATCH_SIZE];   /* only set when reading */
+    uint8_t rif[RIF_DIR_BATCH_SIZE][RIF_MAX_SIZE];
+    uint16_t size[RIF_DIR_BATCH_SIZE];
+    int status[RIF_DIR_BATCH_SIZE];         /* check_rif() result or RIF_DIR_ERR_xxx */
+} rif_dir_batch;
+
+bool rif_dir_exists(const char* path);
+
+/*
+ * Walk the tree under path, using up to max_workers threads (0 for
+ * RIF_DIR_MAX_WORKERS), and collect the files with a .rif extension. Symbolic links
+ * to directories are not followed, and subdirectories that cannot be listed are
+ * skipped. Returns false if path itself cannot be read, in which case dir is
+ * empty.
+ */
+bool rif_dir_list(rif_dir* dir, const char* path, size_t max_workers);
+
+/*
+ * Read and validate up to RIF_DIR_BATCH_SIZE files of dir, starting with the
+ * one at index first, concurrently. The results are in the same order as the
+ * files of dir.
+ */
+void rif_dir_read(const rif_dir* dir, uint32_t first, rif_dir_batch* batch, size_t max_workers);
+
+void rif_dir_free(rif_dir* dir);
+
+/* Create a directory, unless it already exists */
+bool rif_dir_create(const char* path);
+
+/*
+ * Write the RIFs of batch, which must all have passed check_rif() since their
+ * CONTENT_ID makes up the path, as <path>/<TITLE_ID>/<CONTENT_ID>.rif, using
+ * up to max_workers threads (0 for RIF_DIR_MAX_WORKERS). The RIFs of the same
+ * TITLE_ID are written by the same worker, which creates their directory first,
+ * so batches sorted by CONTENT_ID create each directory only once. status is
+ * set to ZRIF_OK or RIF_DIR_ERR_WRITE.
+ */
+void rif_dir_write(const char* path, rif_dir_batch* batch, size_t max_workers);
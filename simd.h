@@ -0,0 +1,46 @@
+/*
+  Vitali - Vita License database updater
+  Copyright © 2017-2018 - VitaSmith
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Selection of the 128-bit SIMD instruction set: SSE2 on x86 and x64, NEON on
+ * ARM when the compiler has been told it is available. Code using them must
+ * also provide a plain C version, for when neither is defined.
+ */
+
+#pragma once
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define USE_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define USE_NEON
+#endif
+
+/* Index of the lowest bit set in x, which must not be 0 */
+#if defined(_MSC_VER)
+#include <intrin.h>
+static __inline int ctz(unsigned int x)
+{
+    unsigned long i;
+    _BitScanForward(&i, x);
+    return (int)i;
+}
+#else
+#define ctz(x)              __builtin_ctz(x)
+#endif
@@ -0,0 +1,176 @@
+/*
+  Vitali - Vita License database updater
+  Copyright © 2017-2018 - VitaSmith
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#define PSAPI_VERSION 2
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__vita__)
+#include <psp2/kernel/processmgr.h>
+#else
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
+#include "stats.h"
+
+static const char* phase_names[PHASE_MAX] = {
+    "download", "read", "unzip", "cache", "seed", "scan", "lookup", "base64",
+    "inflate", "adler32", "insert", "commit", "persist", "total"
+};
+
+uint64_t stats_clock(void)
+{
+#if defined(_WIN32)
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (freq.QuadPart == 0)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000000ULL +
+        (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000000ULL / freq.QuadPart;
+#elif defined(__vita__)
+    return sceKernelGetProcessTimeWide() * 1000ULL;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+uint64_t stats_cpu_clock(void)
+{
+#if defined(_WIN32)
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+        return 0;
+    return ((((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+        (((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime)) * 100ULL;
+#elif defined(__vita__)
+    /* No per process CPU time on the Vita */
+    return 0;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+uint64_t stats_peak_rss(void)
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return 0;
+    return (uint64_t)pmc.PeakWorkingSetSize;
+#elif defined(__vita__)
+    return 0;
+#else
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0)
+        return 0;
+#if defined(__APPLE__)
+    return (uint64_t)ru.ru_maxrss;
+#else
+    return (uint64_t)ru.ru_maxrss * 1024ULL;
+#endif
+#endif
+}
+
+void stats_begin(stats_mark* mark)
+{
+    mark->wall = stats_clock();
+    mark->cpu = stats_cpu_clock();
+}
+
+void stats_end(phase_stats* phase, const stats_mark* mark, uint64_t bytes, uint64_t items)
+{
+    phase->wall += stats_clock() - mark->wall;
+#if !defined(__vita__)
+    phase->cpu += stats_cpu_clock() - mark->cpu;
+    phase->has_cpu = true;
+#endif
+    phase->bytes += bytes;
+    phase->items += items;
+}
+
+void stats_merge(phase_stats* dst, const phase_stats* src)
+{
+    for (int i = 0; i < PHASE_MAX; i++) {
+        dst[i].wall += src[i].wall;
+        dst[i].cpu += src[i].cpu;
+        dst[i].bytes += src[i].bytes;
+        dst[i].items += src[i].items;
+        dst[i].has_cpu |= src[i].has_cpu;
+    }
+}
+
+/* Throughput of a phase, in units per second of wall time */
+static double rate(const phase_stats* phase, uint64_t units)
+{
+    return (phase->wall == 0) ? 0.0 : units * 1e9 / phase->wall;
+}
+
+void stats_print(FILE* fd, bool json, const phase_stats* phases,
+                 const stats_counter* counters, size_t nb_counters)
+{
+    const char* sep = "";
+    size_t i;
+
+    if (json) {
+        fprintf(fd, "{\n  \"phases\": {");
+        for (i = 0; i < PHASE_MAX; i++) {
+            if ((phases[i].wall == 0) && (phases[i].items == 0))
+                continue;
+            fprintf(fd, "%s\n    \"%s\": { \"wall_ms\": %.3f, \"cpu_ms\": ", sep, phase_names[i], phases[i].wall / 1e6);
+            if (phases[i].has_cpu)
+                fprintf(fd, "%.3f", phases[i].cpu / 1e6);
+            else
+                fprintf(fd, "null");
+            fprintf(fd, ", \"bytes\": %llu, \"items\": %llu, \"mb_per_s\": %.1f, \"items_per_s\": %.0f }",
+                (unsigned long long)phases[i].bytes, (unsigned long long)phases[i].items,
+                rate(&phases[i], phases[i].bytes) / (1024.0 * 1024.0), rate(&phases[i], phases[i].items));
+            sep = ",";
+        }
+        fprintf(fd, "\n  },\n  \"counters\": {");
+        for (i = 0; i < nb_counters; i++)
+            fprintf(fd, "%s\n    \"%s\": %lld", (i == 0) ? "" : ",", counters[i].name, (long long)counters[i].value);
+        fprintf(fd, "\n  }\n}\n");
+        return;
+    }
+
+    fprintf(fd, "\n%-10s %12s %12s %14s %10s %10s %12s\n", "Phase", "Wall (ms)", "CPU (ms)", "Bytes", "Items",
+        "MB/s", "Items/s");
+    for (i = 0; i < PHASE_MAX; i++) {
+        char cpu[32] = "-";
+        if ((phases[i].wall == 0) && (phases[i].items == 0))
+            continue;
+        if (phases[i].has_cpu)
+            snprintf(cpu, sizeof(cpu), "%.1f", phases[i].cpu / 1e6);
+        fprintf(fd, "%-10s %12.1f %12s %14llu %10llu %10.1f %12.0f\n", phase_names[i], phases[i].wall / 1e6, cpu,
+            (unsigned long long)phases[i].bytes, (unsigned long long)phases[i].items,
+            rate(&phases[i], phases[i].bytes) / (1024.0 * 1024.0), rate(&phases[i], phases[i].items));
+    }
+    fprintf(fd, "\n");
+    for (i = 0; i < nb_counters; i++)
+        fprintf(fd, "%-22s %lld\n", counters[i].name, (long long)counters[i].value);
+}
@@ -0,0 +1,96 @@
+/*
+  Vitali - Vita License database updater
+  Copyright © 2017-2018 - VitaSmith
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Low overhead instrumentation of the phases of a run: wall time, CPU time
+ * (for the phases that are not timed per license), bytes and items.
+ */
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define PHASE_DOWNLOAD      0
+#define PHASE_READ          1
+#define PHASE_UNZIP         2
+/* Hashing of the source and mapping or writing of the --cache file */
+#define PHASE_CACHE         3
+/* Loading of an existing database into memory, with --memory */
+#define PHASE_SEED          4
+/* Scanning includes the decoding and insertion phases below */
+#define PHASE_SCAN          5
+#define PHASE_LOOKUP        6
+#define PHASE_BASE64        7
+#define PHASE_INFLATE       8
+#define PHASE_ADLER32       9
+#define PHASE_INSERT        10
+#define PHASE_COMMIT        11
+/* Writing of the in-memory database to disk, with --memory */
+#define PHASE_PERSIST       12
+#define PHASE_TOTAL         13
+#define PHASE_MAX           14
+
+typedef struct {
+    uint64_t wall;              /* nanoseconds */
+    uint64_t cpu;               /* nanoseconds, if has_cpu is set */
+    uint64_t bytes;
+    uint64_t items;
+    bool has_cpu;
+} phase_stats;
+
+/* Starting point of a phase that is timed with stats_begin()/stats_end() */
+typedef struct {
+    uint64_t wall;
+    uint64_t cpu;
+} stats_mark;
+
+typedef struct {
+    const char* name;
+    int64_t value;
+} stats_counter;
+
+/* Monotonic wall clock and process CPU time, in nanoseconds */
+uint64_t stats_clock(void);
+uint64_t stats_cpu_clock(void);
+/* Peak resident set size in bytes, or 0 if unknown */
+uint64_t stats_peak_rss(void);
+
+void stats_begin(stats_mark* mark);
+void stats_end(phase_stats* phase, const stats_mark* mark, uint64_t bytes, uint64_t items);
+/* Add all the PHASE_MAX phases of src, such as those timed by another thread, to dst */
+void stats_merge(phase_stats* dst, const phase_stats* src);
+
+/*
+ * Add the wall time elapsed since start to a phase that is timed per item,
+ * where a CPU time syscall would cost more than the work itself. Returns the
+ * current time, so that consecutive phases can be chained.
+ */
+static inline uint64_t stats_add(phase_stats* phase, uint64_t start, uint64_t bytes)
+{
+    uint64_t now = stats_clock();
+    phase->wall += now - start;
+    phase->bytes += bytes;
+    phase->items++;
+    return now;
+}
+
+/* Print the phases that ran, followed by the counters, as text or JSON */
+void stats_print(FILE* fd, bool json, const phase_stats* phases,
+                 const stats_counter* counters, size_t nb_counters);
@@ -0,0 +1,218 @@
+#!/usr/bin/env python3
+#
+#  Vitali - Vita License database updater
+#  Copyright © 2017-2018 - VitaSmith
+#
+#  This program is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+"""
+Run vitali against a local fake server that answers with 429 and 503 errors,
+with or without Retry-After, drops the connection in the middle of a transfer
+and then expects the download to resume with a Range request, to check that
+transient failures are retried the way the README says they are.
+
+Usage: download.py VITALI FEED
+
+FEED is served as http://127.0.0.1:PORT/feed.csv, and the resulting databases
+are compared with the one vitali creates from the local file. Every scenario
+is run with curl, and then with wget, when they are installed.
+"""
+
+import http.server
+import os
+import shutil
+import socket
+import sqlite3
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+ETAG = '"vitali-test"'
+# Retry-After we are prepared to wait for, and one vitali must refuse to wait for
+SHORT_RETRY = 1
+LONG_RETRY = 600
+TIMEOUT = 120
+
+# Each scenario lists what the server does for each request, with 'ok' for the
+# requests that come after, the exit code expected from vitali, and the number
+# of requests expected from it.
+SCENARIOS = [
+    ("429 with Retry-After", [("status", 429, SHORT_RETRY)], 0, 2),
+    ("503 without Retry-After", [("status", 503, None)], 0, 2),
+    ("Dropped connection, resumed with a Range request", [("drop", 64 * 1024)], 0, 2),
+    ("503 and dropped connection", [("status", 503, SHORT_RETRY), ("drop", 100000)], 0, 3),
+    ("Retry-After beyond the longest wait", [("status", 429, LONG_RETRY)], 1, 1),
+]
+
+
+class FakeServer(http.server.ThreadingHTTPServer):
+    daemon_threads = True
+    allow_reuse_address = True
+
+    def __init__(self, data):
+        super().__init__(("127.0.0.1", 0), FakeHandler)
+        self.data = data
+        self.reset([])
+
+    def reset(self, plan):
+        self.plan = list(plan)
+        self.requests = []
+        self.sent = 0
+
+
+class FakeHandler(http.server.BaseHTTPRequestHandler):
+    def log_message(self, format, *args):
+        pass
+
+    def do_GET(self):
+        server = self.server
+        n = len(server.requests)
+        step = server.plan[n] if n < len(server.plan) else ("ok",)
+        server.requests.append({"time": time.monotonic(), "range": self.headers.get("Range"),
+                                "if_range": self.headers.get("If-Range")})
+        if step[0] == "status":
+            body = b"Try again later\n"
+            self.send_response(step[1])
+            if step[2] is not None:
+                self.send_header("Retry-After", str(step[2]))
+            self.send_header("Content-Length", str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+            return
+
+        data, start = server.data, 0
+        rng = self.headers.get("Range")
+        if_range = self.headers.get("If-Range")
+        if rng is not None and rng.startswith("bytes=") and (if_range is None or if_range == ETAG):
+            start = int(rng[6:].split("-")[0])
+            self.send_response(206)
+            self.send_header("Content-Range", "bytes %d-%d/%d" % (start, len(data) - 1, len(data)))
+        else:
+            self.send_response(200)
+        self.send_header("ETag", ETAG)
+        self.send_header("Accept-Ranges", "bytes")
+        self.send_header("Content-Length", str(len(data) - start))
+        self.end_headers()
+        end = len(data) if step[0] == "ok" else min(start + step[1], len(data))
+        self.wfile.write(data[start:end])
+        self.wfile.flush()
+        server.sent += end - start
+        if step[0] == "drop":
+            self.connection.shutdown(socket.SHUT_RDWR)
+            self.close_connection = True
+
+
+def dump_licenses(path):
+    try:
+        db = sqlite3.connect(path)
+        rows = db.execute("SELECT * FROM Licenses ORDER BY CONTENT_ID").fetchall()
+        db.close()
+        return rows
+    except sqlite3.Error:
+        return None
+
+
+def run_vitali(vitali, args, cwd, path):
+    env = dict(os.environ)
+    if path is not None:
+        env["PATH"] = path
+    return subprocess.run([vitali, "--no-progress"] + args, cwd=cwd, env=env, timeout=TIMEOUT,
+                          stdout=subprocess.PIPE, stderr=subprocess.STDOUT).returncode
+
+
+def check(server, vitali, url, name, plan, expected_rc, expected_requests, reference, workdir, path):
+    db = os.path.join(workdir, "test.db")
+    if os.path.exists(db):
+        os.remove(db)
+    server.reset(plan)
+    rc = run_vitali(vitali, [url, db], workdir, path)
+    reqs = server.requests
+    if rc != expected_rc:
+        return "exit code %d instead of %d" % (rc, expected_rc)
+    if len(reqs) != expected_requests:
+        return "%d requests instead of %d" % (len(reqs), expected_requests)
+    for i, step in enumerate(plan[:len(reqs) - 1]):
+        if step[0] == "status" and step[2] is not None and reqs[i + 1]["time"] - reqs[i]["time"] < step[2]:
+            return "retried after %.1f s despite a Retry-After of %d s" % (reqs[i + 1]["time"] - reqs[i]["time"], step[2])
+        if step[0] == "drop":
+            resumed = reqs[i + 1]
+            if resumed["range"] is None or not resumed["range"].startswith("bytes=") or resumed["range"][6:] == "0-":
+                return "download was not resumed (Range: %s)" % resumed["range"]
+            if resumed["if_range"] is not None and resumed["if_range"] != ETAG:
+                return "resumed with If-Range: %s" % resumed["if_range"]
+    if expected_rc != 0:
+        return None
+    if server.sent != len(server.data) and any(step[0] == "drop" for step in plan):
+        return "%d bytes served for a %d bytes feed" % (server.sent, len(server.data))
+    if dump_licenses(db) != reference:
+        return "the licenses differ from the ones of the local feed"
+    return None
+
+
+def main():
+    if len(sys.argv) != 3:
+        print(__doc__.strip())
+        return 1
+    vitali, feed = os.path.abspath(sys.argv[1]), os.path.abspath(sys.argv[2])
+    with open(feed, "rb") as f:
+        data = f.read()
+    workdir = tempfile.mkdtemp(prefix="vitali_download_")
+    server = FakeServer(data)
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    url = "http://127.0.0.1:%d/feed.csv" % server.server_address[1]
+    failed = 0
+
+    try:
+        ref_db = os.path.join(workdir, "reference.db")
+        if run_vitali(vitali, [feed, ref_db], workdir, None) != 0:
+            print("Cannot create the reference database from '%s'" % feed)
+            return 1
+        reference = dump_licenses(ref_db)
+
+        # wget is only used when curl can't be found, so hide curl for the second pass
+        tools = []
+        if shutil.which("curl") is not None:
+            tools.append(("curl", None))
+        if shutil.which("wget") is not None:
+            bindir = os.path.join(workdir, "bin")
+            os.mkdir(bindir)
+            os.symlink(shutil.which("wget"), os.path.join(bindir, "wget"))
+            tools.append(("wget", bindir))
+        if not tools:
+            print("Neither curl nor wget is installed - Skipping the download checks")
+            return 0
+
+        for tool, path in tools:
+            for name, plan, expected_rc, expected_requests in SCENARIOS:
+                start = time.monotonic()
+                err = check(server, vitali, url, name, plan, expected_rc, expected_requests, reference,
+                            workdir, path)
+                print("%s: %s (%s, %.1f s)" % ("FAIL" if err else "PASS", name, tool, time.monotonic() - start)
+                      + (" - " + err if err else ""))
+                sys.stdout.flush()
+                failed += err is not None
+    finally:
+        server.shutdown()
+        shutil.rmtree(workdir, ignore_errors=True)
+
+    if failed:
+        print("%d download check(s) failed" % failed)
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,136 @@
+/*
+  Vitali - Vita License database updater
+  Copyright © 2017-2018 - VitaSmith
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Minimal portable threading wrappers: Win32 threads on Windows and
+ * pthreads everywhere else (including the Vita, through the SDK's libpthread).
+ */
+
+#pragma once
+#include <stdbool.h>
+
+#if defined(_WIN32)
+/* Condition variables require Vista or later */
+#if !defined(_WIN32_WINNT) || (_WIN32_WINNT < 0x0600)
+#undef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600
+#endif
+#include <windows.h>
+#include <process.h>
+
+typedef HANDLE thread_t;
+typedef unsigned (__stdcall *thread_func)(void*);
+#define THREAD_FUNC(name)   unsigned __stdcall name(void* arg)
+#define per_thread          __declspec(thread)
+#define THREAD_RETURN       return 0
+
+static __inline bool thread_create(thread_t* thread, thread_func func, void* arg)
+{
+    *thread = (HANDLE)_beginthreadex(NULL, 0, func, arg, 0, NULL);
+    return (*thread != NULL);
+}
+
+static __inline void thread_join(thread_t thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+/* Returns the value of *ptr prior to the addition */
+static __inline long atomic_add(volatile long* ptr, long val)
+{
+    return InterlockedExchangeAdd(ptr, val);
+}
+
+typedef CRITICAL_SECTION mutex_t;
+typedef CONDITION_VARIABLE cond_t;
+
+static __inline void mutex_init(mutex_t* mutex)     { InitializeCriticalSection(mutex); }
+static __inline void mutex_destroy(mutex_t* mutex)  { DeleteCriticalSection(mutex); }
+static __inline void mutex_lock(mutex_t* mutex)     { EnterCriticalSection(mutex); }
+static __inline void mutex_unlock(mutex_t* mutex)   { LeaveCriticalSection(mutex); }
+static __inline void cond_init(cond_t* cond)        { InitializeConditionVariable(cond); }
+static __inline void cond_destroy(cond_t* cond)     { (void)cond; }
+static __inline void cond_broadcast(cond_t* cond)   { WakeAllConditionVariable(cond); }
+
+/* Must be called with mutex locked, which it is again on return */
+static __inline void cond_wait(cond_t* cond, mutex_t* mutex)
+{
+    SleepConditionVariableCS(cond, mutex, INFINITE);
+}
+
+static __inline int cpu_count(void)
+{
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return (int)si.dwNumberOfProcessors;
+}
+#else
+#include <pthread.h>
+#include <unistd.h>
+
+typedef pthread_t thread_t;
+typedef void* (*thread_func)(void*);
+#define THREAD_FUNC(name)   void* name(void* arg)
+#define per_thread          __thread
+#define THREAD_RETURN       return NULL
+
+static inline bool thread_create(thread_t* thread, thread_func func, void* arg)
+{
+    return (pthread_create(thread, NULL, func, arg) == 0);
+}
+
+static inline void thread_join(thread_t thread)
+{
+    pthread_join(thread, NULL);
+}
+
+/* Returns the value of *ptr prior to the addition */
+static inline long atomic_add(volatile long* ptr, long val)
+{
+    return __sync_fetch_and_add(ptr, val);
+}
+
+typedef pthread_mutex_t mutex_t;
+typedef pthread_cond_t cond_t;
+
+static inline void mutex_init(mutex_t* mutex)       { pthread_mutex_init(mutex, NULL); }
+static inline void mutex_destroy(mutex_t* mutex)    { pthread_mutex_destroy(mutex); }
+static inline void mutex_lock(mutex_t* mutex)       { pthread_mutex_lock(mutex); }
+static inline void mutex_unlock(mutex_t* mutex)     { pthread_mutex_unlock(mutex); }
+static inline void cond_init(cond_t* cond)          { pthread_cond_init(cond, NULL); }
+static inline void cond_destroy(cond_t* cond)       { pthread_cond_destroy(cond); }
+static inline void cond_broadcast(cond_t* cond)     { pthread_cond_broadcast(cond); }
+
+/* Must be called with mutex locked, which it is again on return */
+static inline void cond_wait(cond_t* cond, mutex_t* mutex)
+{
+    pthread_cond_wait(cond, mutex);
+}
+
+static inline int cpu_count(void)
+{
+#if defined(__vita__)
+    /* Applications get three of the four Cortex-A9 cores */
+    return 3;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (int)n : 1;
+#endif
+}
+#endif
@@ -0,0 +1,547 @@
+/*
+  Vitali - Vita License database updater
+  Copyright © 2017-2018 - VitaSmith
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "unzip.h"
+#include "puff.h"
+#include "thread.h"
+
+#define ZIP_EOCD_SIZE           22
+#define ZIP_CD_ENTRY_SIZE       46
+#define ZIP_LOCAL_HEADER_SIZE   30
+#define ZIP64_LOCATOR_SIZE      20
+#define ZIP64_EOCD_SIZE         56
+#define ZIP64_EXTRA_ID          0x0001
+#define ZIP64_SATURATED         0xFFFFFFFF
+#define GZIP_HEADER_SIZE        10
+#define GZIP_TRAILER_SIZE       8
+#define GZIP_FHCRC              0x02
+#define GZIP_FEXTRA             0x04
+#define GZIP_FNAME              0x08
+#define GZIP_FCOMMENT           0x10
+#define ADLER32_MOD             65521
+/* Largest n such that 255n(n+1)/2 + (n+1)(ADLER32_MOD-1) fits in 32 bits */
+#define ADLER32_NMAX            5552
+
+/* Output of a member, as inflated by a worker ahead of its consumer */
+typedef struct {
+    uint8_t* buf;               /* ZIP_PIPE_CHUNKS chunks of up to ZIP_STREAM_WINDOW bytes */
+    size_t len[ZIP_PIPE_CHUNKS];
+    size_t head, tail;          /* number of chunks written and read */
+    bool stop;                  /* the consumer wants no more of the member */
+    bool done;                  /* the worker is done with the member, and set its err */
+} zip_pipe;
+
+typedef struct {
+    zip_member* members;
+    zip_pipe* pipes;
+    size_t nb_members;
+    size_t max_ahead;           /* how far ahead of the consumer the workers may go */
+    size_t next;                /* next member for a worker to inflate */
+    size_t current;             /* member being consumed */
+    mutex_t lock;
+    cond_t cond;
+} zip_job;
+
+typedef struct {
+    zip_job* job;
+    zip_pipe* pipe;
+} zip_writer;
+
+static uint32_t crc32_table[8][256];
+
+/* Vita doesn't seem to like casting to (uint32_t*) */
+static inline uint16_t getle16(const uint8_t* p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t getle32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t getle64(const uint8_t* p)
+{
+    return (uint64_t)getle32(p) | ((uint64_t)getle32(&p[4]) << 32);
+}
+
+static inline uint32_t getbe32(const uint8_t* p)
+{
+    return (uint32_t)p[3] | ((uint32_t)p[2] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[0] << 24);
+}
+
+/*
+ * Slice-by-8 tables: crc32_table[0] is the regular byte-wise table, and
+ * crc32_table[k][i] is the CRC of byte i followed by k zero bytes.
+ */
+void zip_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? (c >> 1) ^ 0xEDB88320 : c >> 1;
+        crc32_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int k = 1; k < 8; k++)
+            crc32_table[k][i] = (crc32_table[k - 1][i] >> 8) ^ crc32_table[0][crc32_table[k - 1][i] & 0xFF];
+    }
+}
+
+uint32_t zip_crc32(uint32_t crc, const uint8_t* data, size_t size)
+{
+    crc = ~crc;
+    while ((size > 0) && ((uintptr_t)data & 7)) {
+        crc = crc32_table[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+        size--;
+    }
+    while (size >= 8) {
+        uint32_t lo = crc ^ getle32(data);
+        uint32_t hi = getle32(&data[4]);
+        crc = crc32_table[7][lo & 0xFF] ^ crc32_table[6][(lo >> 8) & 0xFF] ^
+              crc32_table[5][(lo >> 16) & 0xFF] ^ crc32_table[4][lo >> 24] ^
+              crc32_table[3][hi & 0xFF] ^ crc32_table[2][(hi >> 8) & 0xFF] ^
+              crc32_table[1][(hi >> 16) & 0xFF] ^ crc32_table[0][hi >> 24];
+        data += 8;
+        size -= 8;
+    }
+    while (size--)
+        crc = crc32_table[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+uint32_t zip_adler32(uint32_t adler, const uint8_t* data, size_t size)
+{
+    uint32_t a = adler & 0xFFFF;
+    uint32_t b = adler >> 16;
+
+    /* Only reduce once every ADLER32_NMAX bytes, rather than for every byte */
+    while (size > 0) {
+        size_t n = (size < ADLER32_NMAX) ? size : ADLER32_NMAX;
+        size -= n;
+        while (n--) {
+            a += *data++;
+            b += a;
+        }
+        a %= ADLER32_MOD;
+        b %= ADLER32_MOD;
+    }
+
+    return (b << 16) | a;
+}
+
+/*
+ * Fetch the 64-bit values of the fields that a central directory entry has
+ * saturated, from its ZIP64 extended information. They are stored in this
+ * order, and only if the matching 32-bit field is 0xFFFFFFFF.
+ */
+static bool zip64_extra(const uint8_t* cd, const uint8_t* end, uint64_t* uncompressed_size,
+                        uint64_t* compressed_size, uint64_t* offset)
+{
+    const uint8_t* extra = &cd[ZIP_CD_ENTRY_SIZE + getle16(&cd[28])];
+    const uint8_t* extra_end = extra + getle16(&cd[30]);
+    uint64_t* fields[3] = { uncompressed_size, compressed_size, offset };
+
+    if (extra_end > end)
+        return false;
+    while (extra + 4 <= extra_end) {
+        const uint8_t* p = &extra[4];
+        const uint8_t* field_end = p + getle16(&extra[2]);
+        if (field_end > extra_end)
+            return false;
+        if (getle16(extra) == ZIP64_EXTRA_ID) {
+            for (int i = 0; i < 3; i++) {
+                if (*fields[i] != ZIP64_SATURATED)
+                    continue;
+                if (p + 8 > field_end)
+                    return false;
+                *fields[i] = getle64(p);
+                p += 8;
+            }
+            return true;
+        }
+        extra = field_end;
+    }
+    return (*uncompressed_size != ZIP64_SATURATED) && (*compressed_size != ZIP64_SATURATED) &&
+           (*offset != ZIP64_SATURATED);
+}
+
+int zip_list(const uint8_t* buf, size_t size, zip_filter filter, zip_member* members, size_t max_members)
+{
+    const uint8_t *eocd = NULL, *eocd64, *cd, *lh;
+    uint64_t nb_entries, cd_offset, offset, compressed_size, uncompressed_size;
+    size_t i, nb_members = 0;
+
+    /* Need to lookup the end table to get the filesizes, since Microsoft decided
+       to annoy everyone by removing them from the local table. WTF?!? */
+    if (size < ZIP_EOCD_SIZE)
+        return -1;
+    for (i = size - ZIP_EOCD_SIZE; ; i--) {
+        if ((buf[i] == 'P') && (buf[i + 1] == 'K') && (buf[i + 2] == 0x05) && (buf[i + 3] == 0x06)) {
+            eocd = &buf[i];
+            break;
+        }
+        /* The EOCD may be followed by a comment of up to 64 KB */
+        if ((i == 0) || (size - i >= ZIP_EOCD_SIZE + 0xFFFF))
+            break;
+    }
+    if (eocd == NULL)
+        return -1;
+    nb_entries = getle16(&eocd[10]);
+    cd_offset = getle32(&eocd[16]);
+
+    /* Archives over 4 GB, or with more than 65535 entries, have a ZIP64 EOCD locator right before the EOCD */
+    lh = (eocd - buf >= ZIP64_LOCATOR_SIZE) ? eocd - ZIP64_LOCATOR_SIZE : NULL;
+    if ((lh != NULL) && (lh[0] == 'P') && (lh[1] == 'K') && (lh[2] == 0x06) && (lh[3] == 0x07)) {
+        offset = getle64(&lh[8]);
+        if (offset > (uint64_t)(lh - buf) || (uint64_t)(lh - buf) - offset < ZIP64_EOCD_SIZE)
+            return -1;
+        eocd64 = &buf[offset];
+        if ((eocd64[0] != 'P') || (eocd64[1] != 'K') || (eocd64[2] != 0x06) || (eocd64[3] != 0x06))
+            return -1;
+        nb_entries = getle64(&eocd64[32]);
+        cd_offset = getle64(&eocd64[48]);
+        eocd = eocd64;
+    }
+    if (cd_offset >= (uint64_t)(eocd - buf))
+        return -1;
+
+    cd = &buf[cd_offset];
+    for (; nb_entries > 0; nb_entries--) {
+        if ((eocd - cd < ZIP_CD_ENTRY_SIZE) || (cd[0] != 'P') || (cd[1] != 'K') || (cd[2] != 0x01) || (cd[3] != 0x02))
+            return -1;
+        uint16_t name_len = getle16(&cd[28]);
+        if ((size_t)(eocd - cd) < (size_t)ZIP_CD_ENTRY_SIZE + name_len + getle16(&cd[30]) + getle16(&cd[32]))
+            return -1;
+        if ((filter == NULL) || filter((const char*)&cd[ZIP_CD_ENTRY_SIZE], name_len)) {
+            if (nb_members >= max_members)
+                return -1;
+            compressed_size = getle32(&cd[20]);
+            uncompressed_size = getle32(&cd[24]);
+            offset = getle32(&cd[42]);
+            if (!zip64_extra(cd, eocd, &uncompressed_size, &compressed_size, &offset))
+                return -1;
+            if ((offset >= size) || (size - offset < ZIP_LOCAL_HEADER_SIZE) || (uncompressed_size > SIZE_MAX))
+                return -1;
+            lh = &buf[offset];
+            if ((lh[0] != 'P') || (lh[1] != 'K') || (lh[2] != 0x03) || (lh[3] != 0x04))
+                return -1;
+            offset += ZIP_LOCAL_HEADER_SIZE + getle16(&lh[26]) + getle16(&lh[28]);
+            if ((offset > size) || (compressed_size > size - offset))
+                return -1;
+            zip_member* m = &members[nb_members++];
+            m->name = (const char*)&cd[ZIP_CD_ENTRY_SIZE];
+            m->name_len = name_len;
+            m->method = getle16(&cd[10]);
+            m->crc32 = getle32(&cd[16]);
+            m->compressed_size = (size_t)compressed_size;
+            m->uncompressed_size = (size_t)uncompressed_size;
+            m->data = &buf[offset];
+            m->err = 0;
+        }
+        cd += ZIP_CD_ENTRY_SIZE + name_len + getle16(&cd[30]) + getle16(&cd[32]);
+    }
+    return (int)nb_members;
+}
+
+bool zip_is_gzip(const uint8_t* buf, size_t size)
+{
+    return (size >= GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE) && (buf[0] == 0x1F) && (buf[1] == 0x8B) && (buf[2] == 8);
+}
+
+bool zip_is_zlib(const uint8_t* buf, size_t size)
+{
+    /* Deflate with a window of at most 32 KB, valid check bits, and no preset dictionary */
+    if ((size < 2 + 1 + 4) || ((buf[0] & 0x0F) != 8) || ((buf[0] >> 4) > 7) ||
+        ((((buf[0] << 8) | buf[1]) % 31) != 0) || (buf[1] & 0x20))
+        return false;
+    /*
+     * Text such as "HK" or "x^" also passes the above, so the header of the first
+     * deflate block must be valid as well
+     */
+    switch ((buf[2] >> 1) & 3) {
+    case 0:
+        /* Stored block, with LEN and NLEN (the one's complement of LEN) */
+        return (size >= 2 + 5 + 4) && ((buf[3] ^ buf[5]) == 0xFF) && ((buf[4] ^ buf[6]) == 0xFF);
+    case 2:
+        /* Dynamic block, with at most 286 literal/length and 30 distance codes */
+        return ((buf[2] >> 3) <= 29) && ((buf[3] & 0x1F) <= 29);
+    case 3:
+        return false;
+    default:
+        return true;
+    }
+}
+
+/* Returns the size of the gzip member header at buf, or 0 if invalid */
+static size_t gzip_header_size(const uint8_t* buf, size_t size)
+{
+    size_t pos = GZIP_HEADER_SIZE;
+
+    if (!zip_is_gzip(buf, size))
+        return 0;
+    if (buf[3] & GZIP_FEXTRA) {
+        if (pos + 2 > size)
+            return 0;
+        pos += 2 + (buf[pos] | (buf[pos + 1] << 8));
+    }
+    if (buf[3] & GZIP_FNAME) {
+        while ((pos < size) && (buf[pos] != 0))
+            pos++;
+        pos++;
+    }
+    if (buf[3] & GZIP_FCOMMENT) {
+        while ((pos < size) && (buf[pos] != 0))
+            pos++;
+        pos++;
+    }
+    if (buf[3] & GZIP_FHCRC)
+        pos += 2;
+    return (pos + GZIP_TRAILER_SIZE <= size) ? pos : 0;
+}
+
+int zip_stream(const uint8_t* buf, size_t size, puff_flush flush, void* opaque)
+{
+    uint8_t* window;
+    size_t pos = 0, header_size, in_size, out_size;
+    uint32_t sum;
+    int err = ZIP_ERR_FORMAT;
+
+    window = malloc(ZIP_STREAM_WINDOW);
+    if (window == NULL)
+        return ZIP_ERR_MEMORY;
+
+    if (zip_is_zlib(buf, size)) {
+        in_size = size - 2;
+        sum = 1;
+        err = puff_stream(window, ZIP_STREAM_WINDOW, &out_size, &buf[2], &in_size, flush, opaque, zip_adler32, &sum);
+        if ((err == 0) && ((2 + in_size + 4 > size) || (getbe32(&buf[2 + in_size]) != sum)))
+            err = ZIP_ERR_CRC;
+        goto out;
+    }
+
+    /* A gzip file may consist of several concatenated members */
+    while (pos < size) {
+        header_size = gzip_header_size(&buf[pos], size - pos);
+        if (header_size == 0) {
+            err = ZIP_ERR_FORMAT;
+            break;
+        }
+        pos += header_size;
+        in_size = size - pos;
+        sum = 0;
+        err = puff_stream(window, ZIP_STREAM_WINDOW, &out_size, &buf[pos], &in_size, flush, opaque, zip_crc32, &sum);
+        if (err != 0)
+            break;
+        pos += in_size;
+        if (pos + GZIP_TRAILER_SIZE > size) {
+            err = ZIP_ERR_SIZE;
+            break;
+        }
+        if (getle32(&buf[pos]) != sum) {
+            err = ZIP_ERR_CRC;
+            break;
+        }
+        if (getle32(&buf[pos + 4]) != (uint32_t)out_size) {
+            err = ZIP_ERR_SIZE;
+            break;
+        }
+        pos += GZIP_TRAILER_SIZE;
+        /* Ignore trailing garbage, such as padding */
+        if (!zip_is_gzip(&buf[pos], size - pos))
+            break;
+    }
+
+out:
+    free(window);
+    return err;
+}
+
+int zip_stream_member(const zip_member* m, puff_flush flush, void* opaque)
+{
+    uint8_t* window;
+    size_t pos, len, in_size = m->compressed_size, out_size = 0;
+    uint32_t crc = 0;
+    int err;
+
+    if (m->method == 0) {
+        if (in_size != m->uncompressed_size)
+            return ZIP_ERR_SIZE;
+        /* Stored data is handed over as is, a window's worth at a time */
+        for (pos = 0; pos < in_size; pos += len) {
+            len = (in_size - pos > ZIP_STREAM_WINDOW) ? ZIP_STREAM_WINDOW : in_size - pos;
+            crc = zip_crc32(crc, &m->data[pos], len);
+            if (flush(opaque, &m->data[pos], len) != 0)
+                return ZIP_ERR_FORMAT;
+        }
+        return (crc == m->crc32) ? 0 : ZIP_ERR_CRC;
+    }
+    if (m->method != 8)
+        return ZIP_ERR_METHOD;
+
+    window = malloc(ZIP_STREAM_WINDOW);
+    if (window == NULL)
+        return ZIP_ERR_MEMORY;
+    err = puff_stream(window, ZIP_STREAM_WINDOW, &out_size, m->data, &in_size, flush, opaque, zip_crc32, &crc);
+    free(window);
+    if (err != 0)
+        return err;
+    if (out_size != m->uncompressed_size)
+        return ZIP_ERR_SIZE;
+    return (crc == m->crc32) ? 0 : ZIP_ERR_CRC;
+}
+
+/* Copy the output of a worker into its pipe, waiting for the consumer to free a chunk when it is full */
+static int zip_pipe_write(void* opaque, const uint8_t* data, size_t len)
+{
+    zip_writer* w = (zip_writer*)opaque;
+    zip_job* job = w->job;
+    zip_pipe* pipe = w->pipe;
+    size_t n, slot;
+    bool stop;
+
+    while (len > 0) {
+        mutex_lock(&job->lock);
+        while (!pipe->stop && (pipe->head - pipe->tail == ZIP_PIPE_CHUNKS))
+            cond_wait(&job->cond, &job->lock);
+        stop = pipe->stop;
+        mutex_unlock(&job->lock);
+        if (stop)
+            return 1;
+        /* The consumer doesn't look at a chunk until it is published */
+        n = (len > ZIP_STREAM_WINDOW) ? ZIP_STREAM_WINDOW : len;
+        slot = pipe->head % ZIP_PIPE_CHUNKS;
+        memcpy(&pipe->buf[slot * ZIP_STREAM_WINDOW], data, n);
+        pipe->len[slot] = n;
+        mutex_lock(&job->lock);
+        pipe->head++;
+        cond_broadcast(&job->cond);
+        mutex_unlock(&job->lock);
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static THREAD_FUNC(zip_pipe_worker)
+{
+    zip_job* job = (zip_job*)arg;
+    zip_writer w = { job, NULL };
+    size_t i;
+    int err;
+
+    mutex_lock(&job->lock);
+    while (job->next < job->nb_members) {
+        i = job->next++;
+        /* Bound the memory used by the members that are waiting to be consumed */
+        while (i >= job->current + job->max_ahead)
+            cond_wait(&job->cond, &job->lock);
+        mutex_unlock(&job->lock);
+        w.pipe = &job->pipes[i];
+        w.pipe->buf = malloc(ZIP_PIPE_CHUNKS * ZIP_STREAM_WINDOW);
+        err = (w.pipe->buf == NULL) ? ZIP_ERR_MEMORY : zip_stream_member(&job->members[i], zip_pipe_write, &w);
+        mutex_lock(&job->lock);
+        job->members[i].err = err;
+        w.pipe->done = true;
+        cond_broadcast(&job->cond);
+    }
+    mutex_unlock(&job->lock);
+    THREAD_RETURN;
+}
+
+/* Hand the output of a member over to flush() as its worker produces it, and wait for its status */
+static void zip_pipe_read(zip_job* job, zip_pipe* pipe, puff_flush flush, void* opaque)
+{
+    size_t slot;
+    int stop;
+
+    mutex_lock(&job->lock);
+    while (!pipe->stop) {
+        while ((pipe->tail == pipe->head) && !pipe->done)
+            cond_wait(&job->cond, &job->lock);
+        if (pipe->tail == pipe->head)
+            break;
+        mutex_unlock(&job->lock);
+        slot = pipe->tail % ZIP_PIPE_CHUNKS;
+        stop = flush(opaque, &pipe->buf[slot * ZIP_STREAM_WINDOW], pipe->len[slot]);
+        mutex_lock(&job->lock);
+        pipe->tail++;
+        pipe->stop = (stop != 0);
+        cond_broadcast(&job->cond);
+    }
+    while (!pipe->done)
+        cond_wait(&job->cond, &job->lock);
+    job->current++;
+    cond_broadcast(&job->cond);
+    mutex_unlock(&job->lock);
+}
+
+size_t zip_stream_members(zip_member* members, size_t nb_members, size_t max_workers,
+                          puff_flush flush, zip_member_done done, void* opaque)
+{
+    thread_t threads[ZIP_MAX_WORKERS];
+    zip_job job;
+    size_t i, nb_threads = 0, extracted = 0;
+
+    memset(&job, 0, sizeof(job));
+    job.members = members;
+    job.nb_members = nb_members;
+
+    if (max_workers == 0)
+        max_workers = (size_t)cpu_count();
+    if (max_workers > ZIP_MAX_WORKERS)
+        max_workers = ZIP_MAX_WORKERS;
+    /* The calling thread consumes the output, and the others inflate ahead of it */
+    job.max_ahead = (max_workers - 1 < nb_members) ? max_workers - 1 : nb_members;
+    if (job.max_ahead > 0)
+        job.pipes = calloc(nb_members, sizeof(zip_pipe));
+    if (job.pipes != NULL) {
+        mutex_init(&job.lock);
+        cond_init(&job.cond);
+        for (; nb_threads < job.max_ahead; nb_threads++) {
+            if (!thread_create(&threads[nb_threads], zip_pipe_worker, &job))
+                break;
+        }
+    }
+
+    for (i = 0; i < nb_members; i++) {
+        if (nb_threads == 0) {
+            members[i].err = zip_stream_member(&members[i], flush, opaque);
+        } else {
+            zip_pipe_read(&job, &job.pipes[i], flush, opaque);
+            free(job.pipes[i].buf);
+        }
+        extracted += (members[i].err == 0);
+        if (done != NULL)
+            done(&members[i], opaque);
+    }
+
+    if (job.pipes != NULL) {
+        for (i = 0; i < nb_threads; i++)
+            thread_join(threads[i]);
+        cond_destroy(&job.cond);
+        mutex_destroy(&job.lock);
+        free(job.pipes);
+    }
+    return extracted;
+}
@@ -0,0 +1,98 @@
+/*
+  Vitali - Vita License database updater
+  Copyright © 2017-2018 - VitaSmith
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "puff.h"
+
+/* Sliding window used when streaming gzip or zlib data */
+#define ZIP_STREAM_WINDOW       (128 * 1024)
+/* Output buffered for each member inflated ahead, in ZIP_STREAM_WINDOW chunks */
+#define ZIP_PIPE_CHUNKS         4
+#define ZIP_MAX_WORKERS         8
+
+typedef struct zip_member {
+    const char* name;           /* not NUL terminated */
+    uint16_t name_len;
+    uint16_t method;            /* 0 = stored, 8 = deflate */
+    uint32_t crc32;             /* expected CRC-32 from the central directory */
+    const uint8_t* data;        /* compressed data */
+    size_t compressed_size;
+    size_t uncompressed_size;
+    int err;                    /* 0 on success, puff() error code or ZIP_ERR_xxx otherwise */
+} zip_member;
+
+#define ZIP_ERR_SIZE            3
+#define ZIP_ERR_CRC             4
+#define ZIP_ERR_MEMORY          5
+#define ZIP_ERR_METHOD          6
+#define ZIP_ERR_FORMAT          7
+
+typedef bool (*zip_filter)(const char* name, size_t name_len);
+typedef void (*zip_member_done)(const zip_member* member, void* opaque);
+
+/*
+ * Fill members[] with the entries of the ZIP archive in buf for which filter
+ * returns true (all entries if filter is NULL). Returns the number of entries
+ * found, or -1 if the archive is invalid or max_members is too small.
+ */
+int zip_list(const uint8_t* buf, size_t size, zip_filter filter, zip_member* members, size_t max_members);
+
+bool zip_is_gzip(const uint8_t* buf, size_t size);
+bool zip_is_zlib(const uint8_t* buf, size_t size);
+
+/*
+ * Inflate a gzip (possibly multi-member) or zlib wrapped buffer through a
+ * ZIP_STREAM_WINDOW sliding window, handing the output over to flush() as it
+ * is produced, and validate the CRC-32 or Adler-32 trailer. Returns 0 on
+ * success, or a puff() error code or ZIP_ERR_xxx otherwise.
+ */
+int zip_stream(const uint8_t* buf, size_t size, puff_flush flush, void* opaque);
+
+/*
+ * Inflate a single member through a ZIP_STREAM_WINDOW sliding window, handing
+ * the output over to flush() as it is produced, so that the member is never
+ * held in memory as a whole, and validate its size and CRC-32. Returns 0 on
+ * success, or a puff() error code or ZIP_ERR_xxx otherwise.
+ */
+int zip_stream_member(const zip_member* m, puff_flush flush, void* opaque);
+
+/*
+ * Inflate and check members concurrently, using up to max_workers threads (0
+ * for as many as there are CPUs), including the calling one, which hands the
+ * output over to flush() one member after the other, in order, and calls done()
+ * once a member is complete and its err set. The other threads inflate the
+ * next members ahead of it, with at most ZIP_PIPE_CHUNKS windows of output kept
+ * for each, so that inflating the members overlaps with consuming them rather
+ * than adding up with it. Returns the number of members successfully extracted.
+ */
+size_t zip_stream_members(zip_member* members, size_t nb_members, size_t max_workers,
+                          puff_flush flush, zip_member_done done, void* opaque);
+
+/*
+ * Build the CRC-32 tables. This must be called once, before any other thread
+ * is started, as zip_crc32() and the functions that check a CRC-32 use them.
+ */
+void zip_init(void);
+
+uint32_t zip_crc32(uint32_t crc, const uint8_t* data, size_t size);
+uint32_t zip_adler32(uint32_t adler, const uint8_t* data, size_t size);
@@ -16,14 +16,20 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+/* Make off_t 64-bit on 32-bit POSIX hosts */
+#define _FILE_OFFSET_BITS   64
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <inttypes.h>
 #include <string.h>
+#include <ctype.h>
+#include <time.h>
 #if !defined(__vita__)
 #include <fcntl.h>
+#include <sys/stat.h>
 #if defined(_WIN32) || defined(__CYGWIN__)
 #include <io.h>
 #include <windows.h>
@@ -37,6 +43,7 @@
 #include <psp2/sysmodule.h>
 #include <psp2/kernel/processmgr.h>
 #include <psp2/io/fcntl.h>
+#include <psp2/io/stat.h>
 #include <psp2/net/net.h>
 #include <psp2/net/netctl.h>
 #include <psp2/net/http.h>
@@ -47,6 +54,14 @@
 #include "sqlite3.h"
 #include "zrif.h"
 #include "puff.h"
+#include "csv.h"
+#include "rifcache.h"
+#include "rifdir.h"
+#include "filter.h"
+#include "unzip.h"
+#include "xml.h"
+#include "thread.h"
+#include "stats.h"
 
 #if defined(_WIN32)
 #define msleep(msecs) Sleep(msecs)
@@ -71,6 +86,7 @@ static inline uint64_t utime(void) {
 #include <unistd.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 #define msleep(msecs) usleep(1000*msecs)
 static inline uint64_t utime(void) {
     struct timeval tv;
@@ -83,10 +99,38 @@ static inline uint64_t utime(void) {
 #define MAX_QUERY_LENGTH    128
 #define ZRIF_URI            "https://nopaystation.com/database/"
 #define REFRESH_STEP        100000ULL
+/* Number of licenses between checks of whether progress should be refreshed */
+#define PROGRESS_INTERVAL   256
+/* Much larger than the zRIF of a PSM RIF, which is the largest kind */
+#define MAX_ZRIF_LENGTH     2048
+/* zRIFs that are validated concurrently in --check mode */
+#define CHECK_BATCH_SIZE    4096
+#define CHECK_BATCH_DATA    (1024 * 1024)
+#define MAX_CHECK_WORKERS   8
+#define MAX_SOURCES         16
+/* Plain text from stdin or a large file is scanned as it arrives, in chunks of that size */
+#define STDIN_CHUNK_SIZE    (256 * 1024)
+/* Text files larger than this are not read into memory */
+#define MAX_BUFFERED_SIZE   (256 * 1024 * 1024)
+/* Largest amount of data requested from a single read() call */
+#define READ_CHUNK_SIZE     (1024 * 1024 * 1024)
+/* Only the start of a source is looked at to work out its format */
+#define SNIFF_WINDOW        (64 * 1024)
+#define SNIFF_TEXT_SIZE     256
+#define GOOGLE_SHEETS_URL   "https://docs.google.com/spreadsheets"
+/* Downloads get that many attempts in all, with the delay between them (in ms) doubling each time */
+#define MAX_DOWNLOAD_ATTEMPTS   5
+#define RETRY_BASE_DELAY        2000
+/* Longest we are prepared to wait before a retry, even when asked to by the server, in ms */
+#define RETRY_MAX_DELAY         (2 * 60 * 1000)
+/* Transfers that stall for that many seconds are aborted, to be resumed */
+#define STALL_TIMEOUT           30
 
 #if defined(__vita__)
 #define ZRIF_TMP_PATH       "ux0:data/vitali.tmp"
 #define LICENSE_DB_PATH     "ux0:license/license.db"
+#define EXPORT_PATH         "ux0:data/license.csv"
+#define EXPORT_RIF_PATH     "ux0:data/license"
 #define SHORTEN_SIZE        41
 #undef  SEEK_SET
 #undef  SEEK_CUR
@@ -96,6 +140,7 @@ static inline uint64_t utime(void) {
 #define SEEK_END            SCE_SEEK_END
 #define _open(path, flags)  sceIoOpen(path, flags, 0777)
 #define _lseek              sceIoLseek
+#define _lseek64            sceIoLseek
 #define _read               sceIoRead
 #define _close              sceIoClose
 #define _O_RDONLY           SCE_O_RDONLY
@@ -104,6 +149,8 @@ static inline uint64_t utime(void) {
 #else
 #define ZRIF_TMP_PATH       "vitali.tmp"
 #define LICENSE_DB_PATH     "license.db"
+#define EXPORT_PATH         "license.csv"
+#define EXPORT_RIF_PATH     "license"
 #define SHORTEN_SIZE        62
 #define perr(...)           fprintf(stderr, __VA_ARGS__)
 #if defined(_WIN32) || defined(__CYGWIN__)
@@ -117,11 +164,96 @@ static inline uint64_t utime(void) {
 #define _O_RDONLY           O_RDONLY
 #define _O_BINARY           0
 #endif
+#if defined(_WIN32)
+#define _lseek64            _lseeki64
+#else
+#define _lseek64            lseek
+#endif
 #endif
 
 #define safe_close(fd)      if (fd > 0) { _close(fd); fd = 0; }
 
-static const char* zrif_charset = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789/+=";
+typedef struct {
+    size_t count, used;
+    volatile long next;
+    const char* zrif[CHECK_BATCH_SIZE];
+    int status[CHECK_BATCH_SIZE];
+    uint64_t line[CHECK_BATCH_SIZE];
+    char data[CHECK_BATCH_DATA];
+} zrif_batch;
+
+typedef struct {
+    sqlite3* db;
+    sqlite3_stmt* lookup;
+    int processed, added, duplicate, failed, filtered;
+    /* Only the licenses that match the filter are added, if not NULL */
+    const content_filter* filter;
+    /* Progress is only looked at every PROGRESS_INTERVAL licenses */
+    bool show_progress;
+    int countdown, progress_len;
+    uint64_t start_tick, last_tick;
+    /* Bytes scanned in previous chunks, start of the current chunk and total size if known */
+    uint64_t scanned;
+    const char* chunk;
+    uint64_t total;
+    /* zRIF being assembled, which may straddle chunks, and its line if known */
+    size_t zrif_len;
+    char zrif[MAX_ZRIF_LENGTH + 1];
+    uint64_t line;
+    /* CSV/TSV sources only have the column called csv_column looked at */
+    const char* csv_column;
+    bool detect_csv;
+    csv_parser csv;
+    /* XLSX sources only have the text of their cells looked at */
+    xml_parser xml;
+    /* --check mode: zRIFs awaiting validation and results per ZRIF_ERR_xxx */
+    zrif_batch* batch;
+    int errors[ZRIF_ERR_MAX];
+    /* Per license phases, timed only if not NULL */
+    phase_stats* phases;
+    /* Collects every decoded RIF, when a cache file is to be written */
+    rif_cache_writer* cache;
+} zrif_scanner;
+
+typedef enum {
+    FORMAT_TEXT,
+    FORMAT_CSV,                 /* text with a delimited header line */
+    FORMAT_XML,
+    FORMAT_HTML,
+    FORMAT_XLSX,
+    FORMAT_GZIP,
+    FORMAT_ZLIB,
+    FORMAT_RIF_DIR,             /* directory tree of .rif files */
+} source_format;
+
+typedef struct {
+    /* Current location, which changes as downloads and redirects are followed */
+    char* uri;
+    char* url;
+    char tmp_path[64];
+    /* Download attempts made so far, including those that got a "Too Many Requests" page */
+    int attempts;
+    char* buf;
+    size_t size;
+    source_format format;
+    /* Text members of an XLSX source, which are inflated while being scanned */
+    zip_member* members;
+    int nb_members;
+    uint64_t xml_size;
+    /* Files of a directory source, which are read while scanning */
+    rif_dir dir;
+    /* Text read from fd (stdin or a large file), of which buf only holds the latest chunk */
+    bool is_stream;
+    int fd;
+    uint64_t streamed;
+    /* Hash the source and leave XLSX extraction to the caller, for --cache */
+    bool use_cache;
+    uint64_t hash, mtime;
+    bool ok;
+    /* Loading phases, merged once all the sources have been loaded */
+    phase_stats phases[PHASE_MAX];
+} zrif_source;
+
 static const char* schema =             \
     "CREATE TABLE Licenses ("           \
     "CONTENT_ID TEXT NOT NULL UNIQUE,"  \
@@ -138,6 +270,9 @@ static const char vbs[] = \
     "Call xHttp.SetRequestHeader(\"Pragma\", \"no-cache\")\n" \
     "Call xHttp.Send()\n" \
     "If Not xHttp.Status = 200 Then\n" \
+    "  Set hFile = createobject(\"Scripting.FileSystemObject\").CreateTextFile(WScript.Arguments(2), True)\n" \
+    "  hFile.Write \"HTTP/1.1 \" & xHttp.Status & vbCrLf & xHttp.getAllResponseHeaders()\n" \
+    "  hFile.Close\n" \
     "  Call WScript.Quit(xHttp.Status)\n" \
     "End If\n" \
     "With bStrm\n" \
@@ -166,7 +301,8 @@ static bool separate_console()
 static char* shorten_uri(const char* uri, size_t max_size)
 {
     size_t i, j;
-    static char str[128];
+    /* Sources are downloaded concurrently */
+    static per_thread char str[128];
     if ((max_size > strlen(uri)) || (max_size > sizeof(str) - 1))
         return (char*)uri;
     /* Shorten after the 3rd slash */
@@ -177,75 +313,17 @@ static char* shorten_uri(const char* uri, size_t max_size)
     if ((i >= strlen(uri)) || (i >= max_size))
         return (char*)uri;
     strncpy(str, uri, i);
+    str[i] = 0;
     strcat(str, "...");
     strcat(str, &uri[strlen(uri) - max_size + strlen(str)]);
     return str;
 }
 
-static char* unzip_xlsx(const char* in_buf, long in_size, long* out_size)
-{
-    const char* shared_strings = "xl/sharedStrings.xml";
-    size_t shared_strings_len = strlen(shared_strings);
-    char *pos, *out_buf = NULL;
-    uint8_t* p;
-    size_t compressed_size = 0, uncompressed_size = 0;
-
-    pos = (char*) in_buf;
-    /* Need to lookup the end table to get the filesize, since Microsoft decided
-       to annoy everyone by removing them from the local table. WTF?!? */
-    while ((pos = memchr(pos, 'P', in_size - ((intptr_t)pos - (intptr_t)in_buf))) != NULL) {
-        if ((pos[1] != 'K') || (pos[2] != 0x01) || (pos[3] != 0x02)) {
-            pos++;
-            continue;
-        }
-        if ((((uint16_t*)pos)[14] != shared_strings_len) || (strncmp(&pos[0x2E], shared_strings, shared_strings_len) != 0)) {
-            pos += 0x24;
-            continue;
-        }
-        /* Vita doesn't seem to like casting to (uint32_t*) */
-        p = (uint8_t*)&pos[20];
-        compressed_size = p[0] + (p[1] << 8) + (p[2] << 16) + (p[3] << 24);
-        p = (uint8_t*)&pos[24];
-        uncompressed_size = p[0] + (p[1] << 8) + (p[2] << 16) + (p[3] << 24);
-        break;
-    }
-    if (compressed_size == 0) {
-        perr("Could not find '%s' in XLSX file\n", shared_strings);
-        goto out;
-    }
-
-    /* Now that we have the sizes, we can process the compressed file */
-    pos = (char*) in_buf;
-    while ((pos = memchr(pos, 'P', in_size - ((intptr_t)pos - (intptr_t)in_buf))) != NULL) {
-        if ((pos[1] != 'K') || (pos[2] != 0x03) || (pos[3] != 0x04)) {
-            pos++;
-            continue;
-        }
-        if ((((uint16_t*)pos)[13] != shared_strings_len) || (strncmp(&pos[0x1E], shared_strings, shared_strings_len) != 0)) {
-            pos += 0x1e;
-            continue;
-        }
-        pos += 0x1e + shared_strings_len;
-        out_buf = malloc(uncompressed_size);
-        if (out_buf == NULL) {
-            perr("Could not allocate xlsx decompression buffer\n");
-            goto out;
-        }
-        if (puff(0, (uint8_t*)out_buf, &uncompressed_size, (uint8_t*)pos, &compressed_size) != 0)
-            perr("Could not decompress '%s' in XLSX file\n", shared_strings);
-        goto out;
-    }
-
-out:
-    *out_size = (long)((out_buf == NULL) ? 0 : uncompressed_size);
-    return out_buf;
-}
-
-#if defined(__vita__)
 static char* size_to_human_readable(uint64_t size)
 {
     const char *suffix_table[] = { "KB", "MB", "GB", "PB" };
-    static char str_size[32];
+    /* Also used to report on the concurrent downloads */
+    static per_thread char str_size[32];
     double hr_size = (double)size;
     const double divider = 1024.0;
     int suffix;
@@ -263,341 +341,2142 @@ static char* size_to_human_readable(uint64_t size)
     return str_size;
 }
 
-static void http_init()
+static inline bool is_compressed(source_format format)
 {
-    const int size = 4 * 1024 * 1024;
-    sceSysmoduleLoadModule(SCE_SYSMODULE_NET);
-    sceSysmoduleLoadModule(SCE_SYSMODULE_HTTP);
-    SceNetInitParam netInitParam;
-    netInitParam.memory = malloc(size);
-    netInitParam.size = size;
-    netInitParam.flags = 0;
-    sceNetInit(&netInitParam);
-    sceNetCtlInit();
-    sceHttpInit(size);
+    return (format == FORMAT_GZIP) || (format == FORMAT_ZLIB);
 }
 
-static void http_exit()
+/* strstr() for the size bytes at buf, which need not be NUL terminated */
+static char* find_str(const char* buf, size_t size, const char* str)
 {
-    sceHttpTerm();
-    sceNetCtlTerm();
-    sceNetTerm();
-    sceSysmoduleUnloadModule(SCE_SYSMODULE_HTTP);
-    sceSysmoduleUnloadModule(SCE_SYSMODULE_NET);
+    const char *p = buf, *end = buf + size;
+    size_t len = strlen(str);
+
+    while (((size_t)(end - p) >= len) && ((p = memchr(p, str[0], end - p - len + 1)) != NULL)) {
+        if (memcmp(p, str, len) == 0)
+            return (char*)p;
+        p++;
+    }
+    return NULL;
 }
 
-static int curl_progress_function(void *p, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+/* Compressed data is all but certain to have control characters early on, whereas text doesn't */
+static bool is_text(const char* buf, size_t size)
 {
-    static uint64_t last_tick = 0ULL;
-    uint64_t cur_tick;
-
-    /* Ensure that at least 200 ms have elapsed since last progress */
-    cur_tick = utime();
-    if (cur_tick - last_tick < REFRESH_STEP)
-        return 0;
-    last_tick = cur_tick;
-    printf("\rDownloaded %s", size_to_human_readable(dlnow));
-    return 0;
+    for (size_t i = 0; (i < size) && (i < SNIFF_TEXT_SIZE); i++) {
+        if (((uint8_t)buf[i] < 0x20) && (buf[i] != '\t') && (buf[i] != '\r') && (buf[i] != '\n'))
+            return false;
+    }
+    return true;
 }
 
-static size_t curl_write_function(void *ptr, size_t size, size_t nmemb, void *stream)
+/*
+ * Work out the format of a source from its first SNIFF_WINDOW bytes, so that
+ * the scan for zRIFs is the only pass over the whole of the data. A CSV/TSV
+ * header only tells that the data might have a zRIF column, which the scanner
+ * then looks for.
+ */
+static source_format sniff_format(const char* buf, size_t size)
 {
-    int written = sceIoWrite(*(int*)stream, ptr, size * nmemb);
-    if (written < 0) {
-        perr("Error writing file: 0x%08X\n", (uint32_t)written);
-        return 0;
+    const char *p = buf, *end, *eol;
+
+    if ((size >= 2) && (buf[0] == 'P') && (buf[1] == 'K'))
+        return FORMAT_XLSX;
+    if (zip_is_gzip((const uint8_t*)buf, size))
+        return FORMAT_GZIP;
+    /* A zlib header is only 2 bytes, which can be the start of text too */
+    if (zip_is_zlib((const uint8_t*)buf, size) && !is_text(buf, size))
+        return FORMAT_ZLIB;
+    end = &buf[(size > SNIFF_WINDOW) ? SNIFF_WINDOW : size];
+    if ((end - p >= 3) && (memcmp(p, "\xEF\xBB\xBF", 3) == 0))
+        p += 3;
+    while ((p < end) && ((*p == ' ') || (*p == '\t') || (*p == '\r') || (*p == '\n')))
+        p++;
+    if ((p < end) && (*p == '<')) {
+        if ((find_str(p, end - p, "<html") != NULL) || (find_str(p, end - p, "<HTML") != NULL))
+            return FORMAT_HTML;
+        return FORMAT_XML;
     }
-    return (size_t)written;
+    eol = memchr(p, '\n', end - p);
+    if (eol == NULL)
+        eol = end;
+    for (; p < eol; p++) {
+        if ((*p == '\t') || (*p == ',') || (*p == ';') || (*p == '|'))
+            return FORMAT_CSV;
+    }
+    return FORMAT_TEXT;
 }
 
-static bool download_file(const char *url, const char *dest)
+#define MAX_XLSX_MEMBERS    256
+
+static const char* xlsx_shared_strings = "xl/sharedStrings.xml";
+static const char* xlsx_sheet_prefix = "xl/worksheets/sheet";
+
+/* We want sharedStrings.xml as well as every sheet, since zRIFs may be inline strings */
+static bool is_xlsx_text_member(const char* name, size_t name_len)
 {
-    int fd = 0, http_status = 0;
-    CURL *curl = NULL;
-    CURLcode r = CURLE_RECV_ERROR;
+    size_t prefix_len = strlen(xlsx_sheet_prefix);
+    if ((name_len == strlen(xlsx_shared_strings)) && (strncmp(name, xlsx_shared_strings, name_len) == 0))
+        return true;
+    return (name_len > prefix_len + 4) && (strncmp(name, xlsx_sheet_prefix, prefix_len) == 0)
+        && (strncmp(&name[name_len - 4], ".xml", 4) == 0)
+        && (memchr(&name[prefix_len], '/', name_len - prefix_len) == NULL);
+}
 
-    http_init();
+static void scanner_init(zrif_scanner* sc, sqlite3* db, phase_stats* phases)
+{
+    memset(sc, 0, sizeof(*sc));
+    sc->db = db;
+    sc->csv_column = "zRIF";
+    sc->csv.column = -1;
+    sc->phases = phases;
+    sc->show_progress = true;
+    sc->countdown = PROGRESS_INTERVAL;
+    sc->start_tick = sc->last_tick = utime();
+    if ((db == NULL) || (sqlite3_prepare_v2(db, "SELECT 1 FROM Licenses WHERE CONTENT_ID = ?", -1, &sc->lookup, NULL) != SQLITE_OK))
+        sc->lookup = NULL;
+}
 
-    printf("Downloading '%s'...\n", shorten_uri(url, SHORTEN_SIZE));
+static void scanner_exit(zrif_scanner* sc)
+{
+    sqlite3_finalize(sc->lookup);
+    sc->lookup = NULL;
+}
 
-    curl = curl_easy_init();
-    if (curl == NULL) {
-        perr("Could not open initialize download\n");
-        goto out;
-    }
+static bool is_known_content_id(zrif_scanner* sc, const char* content_id)
+{
+    uint64_t t = (sc->phases != NULL) ? stats_clock() : 0;
+    int rc;
 
-    curl_easy_setopt(curl, CURLOPT_URL, url);
+    if (sc->lookup == NULL)
+        return false;
+    sqlite3_bind_text(sc->lookup, 1, content_id, -1, SQLITE_STATIC);
+    rc = sqlite3_step(sc->lookup);
+    sqlite3_reset(sc->lookup);
+    if (sc->phases != NULL)
+        stats_add(&sc->phases[PHASE_LOOKUP], t, 0);
+    return (rc == SQLITE_ROW);
+}
 
-    curl_easy_setopt(curl, CURLOPT_USERAGENT, "Vitali/" VERSION " (libcur/" LIBCURL_VERSION ")");
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-    /* We need TLS 1.2 support for nopaystation.com */
-    curl_easy_setopt(curl, CURLOPT_SSLVERSION, CURL_SSLVERSION_TLSv1_2);
-    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 20L);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_function);
-    /* Set Curl to display some progress */
-    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
-    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, curl_progress_function);
-    fd = sceIoOpen(dest, SCE_O_WRONLY | SCE_O_CREAT, 0777);
-    if (fd < 0) {
-        perr("Could not open file '%s'\n", dest);
-        goto out;
-    }
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &fd);
+/*
+ * Check whether a zRIF can be skipped, because the filter rejects it or its
+ * CONTENT_ID is already in the database, without decoding it in full
+ */
+static bool skip_zrif(zrif_scanner* sc, const char* zrif)
+{
+    char content_id[RIF_CONTENT_ID_MAX + 1];
 
-    r = curl_easy_perform(curl);
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_status);
-    if (r != CURLE_OK) {
-        perr("Could not download file: %s\n", curl_easy_strerror(r));
-        goto out;
+    if (((sc->lookup == NULL) && (sc->filter == NULL)) || !get_zrif_content_id(zrif, content_id, sizeof(content_id)))
+        return false;
+    if ((sc->filter != NULL) && !filter_match(sc->filter, content_id)) {
+        sc->filtered++;
+        return true;
     }
-    printf("\n");
-
-out:
-    if (fd > 0)
-        sceIoClose(fd);
-    if (curl != NULL)
-        curl_easy_cleanup(curl);
-    http_exit();
-    return (r == CURLE_OK);
+    if (is_known_content_id(sc, content_id)) {
+        sc->duplicate++;
+        return true;
+    }
+    return false;
 }
-#else
-static bool download_file(const char* url, const char* file)
+
+/* Insert a decoded RIF, with where it came from ("zRIF ..." or a path) only used for error reporting */
+static void insert_rif(zrif_scanner* sc, const uint8_t* rif, size_t rif_len, const char* from, const char* name)
 {
-    bool use_vbscript = USE_VBSCRIPT_DOWNLOAD;
-    char *vbs_tmp = "download.vbs";
-    char cmd[1024];
+    int rc;
+    char query[MAX_QUERY_LENGTH];
+    const char *content_id = rif_content_id(rif);
+    uint64_t t = (sc->phases != NULL) ? stats_clock() : 0;
+    sqlite3_stmt *stmt;
 
-    if (use_vbscript) {
-        FILE *vbs_fd = fopen(vbs_tmp, "w");
-        if (vbs_fd != NULL) {
-            fwrite(vbs, 1, sizeof(vbs) - 1, vbs_fd);
-            fclose(vbs_fd);
+    snprintf(query, sizeof(query), "INSERT INTO Licenses VALUES('%s', ?)", content_id);
+    if (((rc = sqlite3_prepare_v2(sc->db, query, -1, &stmt, NULL)) != SQLITE_OK)
+        || ((rc = sqlite3_bind_blob(stmt, 1, rif, (int)rif_len, SQLITE_STATIC)) != SQLITE_OK)
+        || ((rc = sqlite3_step(stmt)) != SQLITE_DONE)
+        || ((rc = sqlite3_finalize(stmt)) != SQLITE_OK)) {
+        if (rc == SQLITE_CONSTRAINT) {
+            sc->duplicate++;
+        } else {
+            perr("\nCannot add %s from %s%s: %s\n", content_id, from, name, sqlite3_errmsg(sc->db));
+            sc->failed++;
         }
+    } else {
+        sc->added++;
     }
+    if (sc->phases != NULL)
+        stats_add(&sc->phases[PHASE_INSERT], t, rif_len);
+}
 
-    printf("Downloading '%s'...\n", shorten_uri(url, SHORTEN_SIZE));
+/* " on line N" for the zRIFs that come from a CSV/TSV source, empty otherwise */
+static const char* at_line(uint64_t line)
+{
+    static char str[32];
 
-    fflush(stdout);
-    if (use_vbscript)
-        snprintf(cmd, sizeof(cmd), "cscript //nologo %s %s %s", vbs_tmp, url, file);
-    else
-        snprintf(cmd, sizeof(cmd), "curl %s -o %s || wget %s -O %s || exit 400",
-            url, file, url, file);
-    int sys_ret = system(cmd);
-    if (sys_ret != 0)
-        printf("Cannot download file - Error %d\n", sys_ret);
-    if (use_vbscript)
-        remove(vbs_tmp);
-    return (sys_ret == 0);
+    if (line == 0)
+        return "";
+    snprintf(str, sizeof(str), " on line %llu", (unsigned long long)line);
+    return str;
 }
-#endif
 
-int main(int argc, char** argv)
+static void add_zrif(zrif_scanner* sc, const char* zrif)
 {
-    int ret = 1, rc, processed = 0, added = 0, duplicate = 0, failed = 0;
-    int fd = 0, rsize;
-    long size;
-    bool is_url, initialize_db = false, needs_keypress = separate_console();
-    char *db_path = LICENSE_DB_PATH;
-    char *zrif_tmp = ZRIF_TMP_PATH;
-    char *zrif_uri = ZRIF_URI;
-    char *content_id, *errmsg = NULL;
-    char *buf = NULL, *zrif = NULL;
-    char query[MAX_QUERY_LENGTH];
     uint8_t rif[1024];
-    uint64_t last_tick = 0, cur_tick;
-    size_t rif_len, zrif_len;
-    sqlite3 *db = NULL;
-    sqlite3_stmt *stmt;
+    size_t rif_len;
+    bool caching = (sc->cache != NULL);
 
-#if defined(__vita__)
-    SceCtrlData pad;
-    init_video();
-    console_init();
-    sceSysmoduleLoadModule(SCE_SYSMODULE_SQLITE);
-    sqlite3_rw_init();
+    sc->processed++;
+    /* Only fully decode and validate the zRIFs we are going to insert, unless we are caching them all */
+    if (!caching && skip_zrif(sc, zrif))
+        return;
+    rif_len = decode_zrif_stats(zrif, rif, sizeof(rif), sc->phases);
+    if (rif_len == 0) {
+#if !defined(__vita__)
+        perr("\nCannot decode zRIF%s: %s\n", at_line(sc->line), zrif);
 #endif
-
-    printf("Vitali v" VERSION " - Vita License database updater\n");
-    printf("Copyright (c) 2017-2018 VitaSmith (GPLv3)\n\n");
-
-    for (int i = 1; i < argc; i++) {
-        if ((strcmp(argv[i], "-v") == 0) || (strcmp(argv[i], "--version") == 0)) {
-            printf("\nVisit https://github.com/VitaSmith/vitali for the source\n");
-            goto out;
-        }
-        if ((strcmp(argv[i], "-h") == 0) || (strcmp(argv[i], "--help") == 0)) {
-            printf("\nUsage: vitali [ZRIF_URI] [DB_FILE]\n");
-            goto out;
+        sc->failed++;
+        return;
+    }
+    if (sc->cache != NULL) {
+        if (!rif_cache_add(sc->cache, rif, rif_len)) {
+            perr("\nCannot add %s to cache - Disabling cache\n", rif_content_id(rif));
+            rif_cache_writer_free(sc->cache);
+            sc->cache = NULL;
         }
-        if (i == 1)
-            zrif_uri = argv[i];
-        else if (i == 2)
-            db_path = argv[i];
     }
+    /* The CONTENT_ID of the decoded RIF has the final say, as it is the one that gets inserted */
+    if ((sc->filter != NULL) && !filter_match(sc->filter, rif_content_id(rif))) {
+        sc->filtered++;
+        return;
+    }
+    if (caching && is_known_content_id(sc, rif_content_id(rif))) {
+        sc->duplicate++;
+        return;
+    }
+    insert_rif(sc, rif, rif_len, "zRIF ", zrif);
+}
 
-
-retry:
-    is_url = (strncmp(zrif_uri, "http", 4) == 0);
-    if (is_url) {
-        if (download_file(zrif_uri, zrif_tmp))
-            zrif_uri = zrif_tmp;
+/* Add a RIF that was read from a file, with status the result of check_rif() */
+static void add_rif(zrif_scanner* sc, const uint8_t* rif, size_t rif_len, int status, const char* path)
+{
+    sc->processed++;
+    if (status != ZRIF_OK) {
+#if !defined(__vita__)
+        if (status == RIF_DIR_ERR_READ)
+            perr("\nCannot read '%s'\n", path);
         else
-            goto out;
+            perr("\nInvalid RIF (%s): %s\n", zrif_strerror(status), path);
+#endif
+        if (status != RIF_DIR_ERR_READ)
+            sc->errors[status]++;
+        sc->failed++;
+        return;
     }
-
-    fd = _open(zrif_uri, _O_RDONLY | _O_BINARY);
-    if (fd <= 0) {
-        perr("Cannot open file '%s'\n", zrif_uri);
-        goto out;
+    /* --check mode: validating the file is all there is to do */
+    if (sc->batch != NULL) {
+        sc->errors[ZRIF_OK]++;
+        return;
     }
-
-    size = _lseek(fd, 0, SEEK_END);
-    if (size < 16) {
-        perr("Size of '%s' is too small\n", zrif_uri);
-        goto out;
+    if ((sc->filter != NULL) && !filter_match(sc->filter, rif_content_id(rif))) {
+        sc->filtered++;
+        return;
+    }
+    if (is_known_content_id(sc, rif_content_id(rif))) {
+        sc->duplicate++;
+        return;
     }
+    insert_rif(sc, rif, rif_len, "", path);
+}
+
+static THREAD_FUNC(check_worker)
+{
+    zrif_batch* batch = (zrif_batch*)arg;
+    long i;
 
-    _lseek(fd, 0, SEEK_SET);
+    while ((i = atomic_add(&batch->next, 1)) < (long)batch->count)
+        batch->status[i] = check_zrif(batch->zrif[i]);
+    THREAD_RETURN;
+}
 
-    free(buf);
-    /* Allow some extra space in case the redirect URL is at the very end of our buffer */
-    buf = malloc(size + 16);
-    if (buf == NULL) {
-        perr("Cannot allocate buffer\n");
-        goto out;
-    }
-    rsize = _read(fd, buf, size);
-    if (rsize != size) {
-        perr("Cannot read from '%s'\n", zrif_uri);
-        goto out;
+/* Validate the queued zRIFs concurrently, and tally the results */
+static void check_batch(zrif_scanner* sc)
+{
+    zrif_batch* batch = sc->batch;
+    thread_t threads[MAX_CHECK_WORKERS];
+    size_t i, nb_threads, max_workers = (size_t)cpu_count();
+
+    if (max_workers > MAX_CHECK_WORKERS)
+        max_workers = MAX_CHECK_WORKERS;
+    batch->next = 0;
+    /* The calling thread also acts as a worker */
+    for (nb_threads = 0; nb_threads + 1 < max_workers; nb_threads++) {
+        if (!thread_create(&threads[nb_threads], check_worker, batch))
+            break;
     }
-    buf[size] = 0;
-    buf[size + 1] = 0;
+    check_worker(batch);
+    for (i = 0; i < nb_threads; i++)
+        thread_join(threads[i]);
 
-    if ((buf[0] == 'P') && (buf[1] == 'K')) {
-        /* Assume that we are dealing with a .xlsx file */
-        printf("Parsing XLSX file...\n");
-        char* new_buf = unzip_xlsx(buf, size, &size);
-        if (new_buf == NULL)
-            goto out;
-        free(buf);
-        buf = new_buf;
-    } else if (strstr(buf, "<title>Too Many Requests</title>") != NULL) {
-        /* Google spreadsheet may return a "Too Many Requests page */
-        safe_close(fd);
-        remove(zrif_tmp);
-        printf("Too many requests - Retrying in 5 seconds...\n");
-        msleep(5000);
-        goto retry;
-    } else {
-        char* p = strstr(buf, "https://docs.google.com/spreadsheets");
-        if (p != NULL) {
-            zrif_uri = p;
-            p = strstr(p, "/edit'");
-        }
-        if (p != NULL) {
-            safe_close(fd);
-            remove(zrif_tmp);
-            strcpy(p, "/export?format=xlsx");
-            goto retry;
+    for (i = 0; i < batch->count; i++) {
+        sc->errors[batch->status[i]]++;
+        if (batch->status[i] != ZRIF_OK) {
+#if !defined(__vita__)
+            perr("\nInvalid zRIF%s (%s): %s\n", at_line(batch->line[i]), zrif_strerror(batch->status[i]), batch->zrif[i]);
+#endif
+            sc->failed++;
         }
     }
-    safe_close(fd);
+    batch->count = 0;
+    batch->used = 0;
+}
 
-    fd = _open(db_path, _O_RDONLY);
-    if (fd > 0) {
-        if (_lseek(fd, 0, SEEK_END) == 0) {
-            printf("Removing stale database '%s'...\n", db_path);
-            safe_close(fd);
-            remove(db_path);
-            initialize_db = true;
+static void queue_zrif(zrif_scanner* sc, const char* zrif, size_t len)
+{
+    zrif_batch* batch = sc->batch;
+
+    sc->processed++;
+    if ((batch->count == CHECK_BATCH_SIZE) || (batch->used + len + 1 > sizeof(batch->data)))
+        check_batch(sc);
+    memcpy(&batch->data[batch->used], zrif, len + 1);
+    batch->line[batch->count] = sc->line;
+    batch->zrif[batch->count++] = &batch->data[batch->used];
+    batch->used += len + 1;
+}
+
+/*
+ * Refresh the progress line, with pos the offset of the scanner in the input.
+ * The clock is only read every PROGRESS_INTERVAL licenses, so that progress
+ * costs next to nothing in the scanning loop.
+ */
+static void update_progress(zrif_scanner* sc, const char* pos)
+{
+    uint64_t cur_tick, elapsed, scanned;
+    int len;
+
+    if (--sc->countdown > 0)
+        return;
+    sc->countdown = PROGRESS_INTERVAL;
+    if (!sc->show_progress)
+        return;
+    cur_tick = utime();
+    if (cur_tick - sc->last_tick < REFRESH_STEP)
+        return;
+    sc->last_tick = cur_tick;
+    elapsed = cur_tick - sc->start_tick;
+    scanned = sc->scanned + (uint64_t)(pos - sc->chunk);
+
+    len = printf("\r%s %d licenses (%s, %.0f/s", (sc->batch != NULL) ? "Checked" : "Processed",
+        sc->processed, size_to_human_readable(scanned), (elapsed == 0) ? 0.0 : sc->processed * 1000000.0 / elapsed);
+    if ((sc->total != 0) && (scanned != 0) && (scanned <= sc->total))
+        len += printf(", ETA %ds", (int)((elapsed * (sc->total - scanned) / scanned + 500000) / 1000000));
+    len += printf(")");
+    /* Blank out what remains of a longer previous line */
+    if (len < sc->progress_len)
+        printf("%*s", sc->progress_len - len, "");
+    if (len > sc->progress_len)
+        sc->progress_len = len;
+    fflush(stdout);
+}
+
+/* Clear the progress line, so that the final report can be printed over it */
+static void end_progress(zrif_scanner* sc)
+{
+    if (sc->progress_len != 0)
+        printf("\r%*s", sc->progress_len, "");
+    sc->progress_len = 0;
+}
+
+/* Append to the zRIF being assembled, and return true if it was terminated */
+static bool append_zrif(zrif_scanner* sc, const char** pos, const char* end, bool last)
+{
+    const char* p = zrif_span(*pos, end);
+
+    if (sc->zrif_len + (p - *pos) <= MAX_ZRIF_LENGTH)
+        memcpy(&sc->zrif[sc->zrif_len], *pos, p - *pos);
+    sc->zrif_len += p - *pos;
+    *pos = p;
+    return (p < end) || last;
+}
+
+static void process_zrif(zrif_scanner* sc)
+{
+    if ((sc->zrif_len >= 4) && (memcmp(sc->zrif, "KO5i", 4) == 0)) {
+        if (sc->zrif_len > MAX_ZRIF_LENGTH) {
+            sc->processed++;
+            sc->failed++;
+            sc->errors[ZRIF_ERR_LENGTH]++;
         } else {
-            safe_close(fd);
+            sc->zrif[sc->zrif_len] = 0;
+            if (sc->batch != NULL)
+                queue_zrif(sc, sc->zrif, sc->zrif_len);
+            else
+                add_zrif(sc, sc->zrif);
         }
-    } else {
-        initialize_db = true;
     }
+    sc->zrif_len = 0;
+}
 
-    rc = sqlite3_open_v2(db_path, &db, SQLITE_OPEN_CREATE | SQLITE_OPEN_READWRITE, NULL);
-    if (rc != SQLITE_OK) {
-        perr("Cannot open database '%s'\n", db_path);
-        goto out;
-    }
+/* Same as scan_zrifs(), for CSV/TSV sources, where only the zRIF column is looked at */
+static void scan_csv_zrifs(zrif_scanner* sc, const char* buf, size_t size, bool last)
+{
+    const char *p = buf, *end = buf + size;
 
-    if (initialize_db) {
-        rc = sqlite3_exec(db, schema, NULL, NULL, NULL);
-        if (rc != SQLITE_OK) {
-            perr("Cannot set database schema\n");
+    if (sc->zrif_len != 0) {
+        if (!append_zrif(sc, &p, end, last))
             goto out;
-        }
+        process_zrif(sc);
+        update_progress(sc, p);
+    }
+    while ((p = csv_next_field(&sc->csv, p, end)) != NULL) {
+        sc->line = sc->csv.row + 1;
+        if (!append_zrif(sc, &p, end, last))
+            break;
+        process_zrif(sc);
+        update_progress(sc, p);
     }
 
-    rc = sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, &errmsg);
-    if (rc != SQLITE_OK) {
-        perr("Cannot create transaction: %s\n", errmsg);
-        goto out;
+out:
+    sc->scanned += size;
+}
+
+/*
+ * A partial marker carried over from the previous chunk may not be the start
+ * of a zRIF once joined with buf, as with a stray 'K' followed by "KO5i". In
+ * which case, drop bytes from it until what is left could still be a marker.
+ */
+static void resume_marker(zrif_scanner* sc, const char* buf, size_t size)
+{
+    while ((sc->zrif_len != 0) && (sc->zrif_len < 4)) {
+        size_t len = ((size < 4 - sc->zrif_len) ? size : 4 - sc->zrif_len);
+        if ((memcmp(sc->zrif, "KO5i", sc->zrif_len) == 0) && (memcmp(buf, &"KO5i"[sc->zrif_len], len) == 0))
+            return;
+        do {
+            memmove(sc->zrif, &sc->zrif[1], --sc->zrif_len);
+        } while ((sc->zrif_len != 0) && (sc->zrif[0] != 'K'));
     }
+}
 
-    zrif = buf;
-    while ((zrif = memchr(zrif, 'K', size - ((intptr_t)zrif - (intptr_t)buf) + 2)) != NULL) {
-        if ((zrif[1] != 'O') || (zrif[2] != '5') || (zrif[3] != 'i')) {
-            zrif++;
+/*
+ * Look for zRIFs in buf, which can be one chunk of a larger stream, in which
+ * case a zRIF that extends to the end of the chunk is carried over to the next
+ * call. last must be set for the final chunk.
+ */
+static void scan_zrifs(zrif_scanner* sc, const char* buf, size_t size, bool last)
+{
+    const char *p = buf, *end = buf + size;
+
+    sc->chunk = buf;
+    /* The header of a CSV/TSV source tells us which column to look at */
+    if (sc->detect_csv && (size != 0)) {
+        sc->detect_csv = false;
+        csv_init(&sc->csv, buf, size, sc->csv_column);
+    }
+    if (sc->csv.column >= 0) {
+        scan_csv_zrifs(sc, buf, size, last);
+        return;
+    }
+    resume_marker(sc, buf, size);
+    if ((sc->zrif_len != 0) && append_zrif(sc, &p, end, last)) {
+        process_zrif(sc);
+        update_progress(sc, p);
+    }
+    if (sc->zrif_len != 0)
+        goto out;
+
+    while ((p < end) && ((p = memchr(p, 'K', end - p)) != NULL)) {
+        /* A partial marker at the end of the chunk is carried over as well */
+        size_t len = ((size_t)(end - p) < 4) ? (size_t)(end - p) : 4;
+        if (memcmp(p, "KO5i", len) != 0) {
+            p++;
             continue;
         }
-        processed++;
-        cur_tick = utime();
-        if (cur_tick - last_tick >= REFRESH_STEP) {
-            last_tick = cur_tick;
-            printf("\rProcessed %d licenses", processed);
-        }
-        zrif_len = strspn(zrif, zrif_charset);
-        zrif[zrif_len] = 0;
-        rif_len = decode_zrif(zrif, rif, sizeof(rif));
-        if (rif_len != 0) {
-            /* PSM and regular RIFs have CONTENT_ID at different offsets */
-            content_id = (char*)&rif[(((uint64_t*)rif)[0] == 0ULL) ? 0x50 : 0x10];
-            snprintf(query, sizeof(query), "INSERT INTO Licenses VALUES('%s', ?)", content_id);
-            if (((rc = sqlite3_prepare_v2(db, query, -1, &stmt, NULL)) != SQLITE_OK)
-                || ((rc = sqlite3_bind_blob(stmt, 1, rif, (int)rif_len, SQLITE_STATIC)) != SQLITE_OK)
-                || ((rc = sqlite3_step(stmt)) != SQLITE_DONE)
-                || ((rc = sqlite3_finalize(stmt)) != SQLITE_OK)) {
-                if (rc == SQLITE_CONSTRAINT) {
-                    duplicate++;
-                } else {
-                    perr("\nCannot add %s from zRIF %s: %s\n", content_id, zrif, sqlite3_errmsg(db));
-                    failed++;
+        if (!append_zrif(sc, &p, end, last))
+            break;
+        process_zrif(sc);
+        update_progress(sc, p);
+    }
+
+out:
+    sc->scanned += size;
+}
+
+static int scan_zrifs_chunk(void* opaque, const uint8_t* data, size_t len)
+{
+    scan_zrifs((zrif_scanner*)opaque, (const char*)data, len, false);
+    return 0;
+}
+
+/* Scan the text of the cells from a window of inflated XML */
+static int scan_xml_chunk(void* opaque, const uint8_t* data, size_t len)
+{
+    zrif_scanner* sc = (zrif_scanner*)opaque;
+    const char *p = (const char*)data, *end = p + len, *text;
+    uint64_t scanned = sc->scanned;
+    size_t text_len;
+
+    while ((text = xml_next_text(&sc->xml, &p, end, &text_len)) != NULL)
+        scan_zrifs(sc, text, text_len, false);
+    /* Progress is measured against the XML, rather than the text we extracted from it */
+    sc->scanned = scanned + len;
+    return 0;
+}
+
+static void scan_xml_done(const zip_member* m, void* opaque)
+{
+    zrif_scanner* sc = (zrif_scanner*)opaque;
+
+    if (m->err != 0)
+        perr("\nCould not extract '%.*s' from XLSX file (error %d)\n", m->name_len, m->name, m->err);
+    /* Don't let a truncated member run into the next one */
+    scan_zrifs(sc, "\n", 1, false);
+    xml_init(&sc->xml);
+}
+
+/* Insert the licenses from a cache file, which are already decoded and sorted by CONTENT_ID */
+static void add_cached_rifs(zrif_scanner* sc, const rif_cache* cache)
+{
+    const uint8_t* rif;
+    size_t rif_len;
+
+    sc->chunk = (const char*)cache->data;
+    for (uint32_t i = 0; i < cache->count; i++) {
+        sc->processed++;
+        rif = rif_cache_rif(cache, i, &rif_len);
+        if ((sc->filter != NULL) && !filter_match(sc->filter, cache->index[i].content_id))
+            sc->filtered++;
+        else if (is_known_content_id(sc, cache->index[i].content_id))
+            sc->duplicate++;
+        else
+            insert_rif(sc, rif, rif_len, "cache", "");
+        update_progress(sc, (const char*)&rif[rif_len]);
+    }
+}
+
+/* Scan the whole of the input, decompressing it on the fly if needed */
+static bool scan_input(zrif_scanner* sc, const char* buf, size_t size, source_format format, const char* uri)
+{
+    int rc;
+
+    if (!is_compressed(format)) {
+        scan_zrifs(sc, buf, size, true);
+        return true;
+    }
+    rc = zip_stream((const uint8_t*)buf, size, scan_zrifs_chunk, sc);
+    scan_zrifs(sc, "", 0, true);
+    if (rc != 0)
+        perr("\nCould not decompress '%s' (error %d)\n", uri, rc);
+    return (rc == 0);
+}
+
+/* Read the files of a directory source a batch at a time, and add them in order */
+static bool scan_rif_dir(zrif_scanner* sc, zrif_source* src)
+{
+    rif_dir_batch* batch = malloc(sizeof(rif_dir_batch));
+
+    if (batch == NULL) {
+        perr("Cannot allocate buffer\n");
+        return false;
+    }
+    /* There is no contiguous input, so progress only goes by the bytes read */
+    sc->chunk = (const char*)batch->rif;
+    for (uint32_t first = 0; first < src->dir.count; first += batch->count) {
+        rif_dir_read(&src->dir, first, batch, 0);
+        for (uint32_t i = 0; i < batch->count; i++) {
+            add_rif(sc, batch->rif[i], batch->size[i], batch->status[i], batch->path[i]);
+            sc->scanned += batch->size[i];
+            src->streamed += batch->size[i];
+            update_progress(sc, sc->chunk);
+        }
+    }
+    free(batch);
+    return true;
+}
+
+/* Scan a source, reading the remainder of it as it arrives if it is a stream */
+static bool scan_source(zrif_scanner* sc, zrif_source* src)
+{
+    int n, processed = sc->processed;
+    uint64_t scanned = sc->scanned;
+
+    if (src->format == FORMAT_RIF_DIR)
+        return scan_rif_dir(sc, src);
+
+    /* The header of compressed data can only be looked at once inflated */
+    sc->detect_csv = (sc->csv_column != NULL) && ((src->format == FORMAT_CSV) || is_compressed(src->format));
+    sc->csv.column = -1;
+    sc->line = 0;
+
+    if (src->format == FORMAT_XLSX) {
+        /* The members are inflated ahead by other threads, while we scan them in order */
+        size_t extracted;
+        xml_init(&sc->xml);
+        extracted = zip_stream_members(src->members, (size_t)src->nb_members, 0, scan_xml_chunk, scan_xml_done, sc);
+        scan_zrifs(sc, "", 0, true);
+        return (extracted == (size_t)src->nb_members);
+    }
+    if (!src->is_stream) {
+        if (!scan_input(sc, src->buf, src->size, src->format, src->uri))
+            return false;
+        /* The header may name a zRIF column that isn't the one with the zRIFs, so look everywhere then */
+        if ((sc->csv.column >= 0) && (sc->processed == processed)) {
+            sc->csv.column = -1;
+            sc->line = 0;
+            sc->scanned = scanned;
+            return scan_input(sc, src->buf, src->size, src->format, src->uri);
+        }
+        return true;
+    }
+    do {
+        scan_zrifs(sc, src->buf, src->size, false);
+        n = _read(src->fd, src->buf, STDIN_CHUNK_SIZE);
+        src->size = (n > 0) ? n : 0;
+        src->streamed += src->size;
+    } while (n > 0);
+    scan_zrifs(sc, "", 0, true);
+    if (n < 0)
+        perr("\nCannot read from '%s'\n", src->uri);
+    else if ((sc->csv.column >= 0) && (sc->processed == processed))
+        perr("\nNo zRIF found in the '%s' column of '%s' - Use --column to select another\n", sc->csv_column, src->uri);
+    return (n == 0);
+}
+
+/*
+ * Validate every zRIF from the sources, without touching the database, so that
+ * feeds can be vetted before they are used. Returns false if any zRIF is invalid.
+ */
+static bool check_zrifs(zrif_scanner* sc, zrif_source* sources, int nb_sources)
+{
+    uint64_t start = utime(), elapsed;
+    bool r = true, found[MAX_SOURCES];
+    int i, processed;
+
+    sc->batch = malloc(sizeof(zrif_batch));
+    if (sc->batch == NULL) {
+        perr("Cannot allocate buffer\n");
+        return false;
+    }
+    sc->batch->count = 0;
+    sc->batch->used = 0;
+    for (i = 0; i < nb_sources; i++) {
+        processed = sc->processed;
+        if (!scan_source(sc, &sources[i]))
+            r = false;
+        found[i] = (sc->processed != processed);
+    }
+    check_batch(sc);
+    free(sc->batch);
+    sc->batch = NULL;
+    end_progress(sc);
+
+    elapsed = utime() - start;
+    printf("\rChecked %d licenses in %.2f s (%.0f licenses/s):\n %d valid, %d invalid.\n",
+        sc->processed, elapsed / 1000000.0, (elapsed == 0) ? 0.0 : sc->processed * 1000000.0 / elapsed,
+        sc->processed - sc->failed, sc->failed);
+    for (i = ZRIF_OK + 1; i < ZRIF_ERR_MAX; i++) {
+        if (sc->errors[i] != 0)
+            printf("  %d: %s\n", sc->errors[i], zrif_strerror(i));
+    }
+    for (i = 0; i < nb_sources; i++) {
+        if (!found[i]) {
+            perr("No zRIF found in '%s'\n", sources[i].uri);
+            r = false;
+        }
+    }
+    return r && (sc->failed == 0);
+}
+
+/*
+ * Write all the licenses from the database as a CONTENT_ID,zRIF CSV file.
+ * Every zRIF is decoded back and compared to the original RIF before being
+ * written, so that the feed we produce is guaranteed to be usable.
+ */
+static bool export_zrifs(sqlite3* db, const char* path)
+{
+    int rc, exported = 0, failed = 0;
+    char zrif[MAX_ZRIF_LENGTH + 1];
+    uint8_t rif[1024];
+    const uint8_t* blob;
+    size_t rif_len;
+    uint64_t start = utime(), elapsed;
+    sqlite3_stmt *stmt = NULL;
+    FILE* fd;
+
+    fd = fopen(path, "w");
+    if (fd == NULL) {
+        perr("Cannot create '%s'\n", path);
+        return false;
+    }
+    rc = sqlite3_prepare_v2(db, "SELECT CONTENT_ID, RIF FROM Licenses ORDER BY CONTENT_ID", -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        perr("Cannot read licenses: %s\n", sqlite3_errmsg(db));
+        fclose(fd);
+        return false;
+    }
+
+    fprintf(fd, "CONTENT_ID,zRIF\n");
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        blob = sqlite3_column_blob(stmt, 1);
+        rif_len = (size_t)sqlite3_column_bytes(stmt, 1);
+        if ((blob == NULL) || (encode_zrif(blob, rif_len, zrif, sizeof(zrif)) == 0) ||
+            (decode_zrif(zrif, rif, sizeof(rif)) != rif_len) || (memcmp(blob, rif, rif_len) != 0)) {
+            perr("\nCannot encode license for %s\n", sqlite3_column_text(stmt, 0));
+            failed++;
+            continue;
+        }
+        fprintf(fd, "%s,%s\n", sqlite3_column_text(stmt, 0), zrif);
+        exported++;
+    }
+    sqlite3_finalize(stmt);
+    fclose(fd);
+    if (rc != SQLITE_DONE) {
+        perr("\nCannot read licenses: %s\n", sqlite3_errmsg(db));
+        return false;
+    }
+
+    elapsed = utime() - start;
+    printf("Exported %d licenses to '%s' (%d failed) in %.2f s (%.0f licenses/s).\n", exported, path, failed,
+        elapsed / 1000000.0, (elapsed == 0) ? 0.0 : exported * 1000000.0 / elapsed);
+    return true;
+}
+
+/*
+ * Write all the licenses from the database as <path>/<TITLE_ID>/<CONTENT_ID>.rif
+ * files, for the devices and tools that read RIFs rather than a database. Rows
+ * are read in CONTENT_ID order, so that the licenses of a title are batched
+ * together, and written by a pool of workers.
+ */
+static bool export_rifs(sqlite3* db, const char* path)
+{
+    int rc, exported = 0, failed = 0;
+    const uint8_t* blob;
+    size_t rif_len;
+    uint64_t start = utime(), elapsed;
+    sqlite3_stmt *stmt = NULL;
+    rif_dir_batch* batch = NULL;
+    bool r = false;
+
+    if (!rif_dir_create(path)) {
+        perr("Cannot create directory '%s'\n", path);
+        return false;
+    }
+    batch = malloc(sizeof(rif_dir_batch));
+    if (batch == NULL) {
+        perr("Cannot allocate buffer\n");
+        return false;
+    }
+    rc = sqlite3_prepare_v2(db, "SELECT CONTENT_ID, RIF FROM Licenses ORDER BY CONTENT_ID", -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        perr("Cannot read licenses: %s\n", sqlite3_errmsg(db));
+        goto out;
+    }
+
+    batch->count = 0;
+    do {
+        rc = sqlite3_step(stmt);
+        if (rc == SQLITE_ROW) {
+            blob = sqlite3_column_blob(stmt, 1);
+            rif_len = (size_t)sqlite3_column_bytes(stmt, 1);
+            /* CONTENT_ID makes up the path, so it must be checked before anything is written */
+            if ((blob == NULL) || (rif_len > RIF_MAX_SIZE) || (check_rif(blob, rif_len) != ZRIF_OK)) {
+                perr("\nInvalid license for %s\n", sqlite3_column_text(stmt, 0));
+                failed++;
+            } else {
+                memcpy(batch->rif[batch->count], blob, rif_len);
+                batch->size[batch->count++] = (uint16_t)rif_len;
+            }
+        }
+        if ((batch->count == RIF_DIR_BATCH_SIZE) || ((rc != SQLITE_ROW) && (batch->count != 0))) {
+            rif_dir_write(path, batch, 0);
+            for (uint32_t i = 0; i < batch->count; i++) {
+                if (batch->status[i] == ZRIF_OK) {
+                    exported++;
+                } else {
+                    perr("\nCannot write license for %s\n", rif_content_id(batch->rif[i]));
+                    failed++;
+                }
+            }
+            batch->count = 0;
+        }
+    } while (rc == SQLITE_ROW);
+    if (rc != SQLITE_DONE) {
+        perr("\nCannot read licenses: %s\n", sqlite3_errmsg(db));
+        goto out;
+    }
+
+    elapsed = utime() - start;
+    printf("Exported %d licenses to '%s' (%d failed) in %.2f s (%.0f licenses/s).\n", exported, path, failed,
+        elapsed / 1000000.0, (elapsed == 0) ? 0.0 : exported * 1000000.0 / elapsed);
+    r = true;
+
+out:
+    sqlite3_finalize(stmt);
+    free(batch);
+    return r;
+}
+
+/* Copy the whole of the main database of src into dst, in a single pass */
+static bool backup_db(sqlite3* dst, sqlite3* src)
+{
+    sqlite3_backup* backup = sqlite3_backup_init(dst, "main", src, "main");
+    if (backup == NULL)
+        return false;
+    sqlite3_backup_step(backup, -1);
+    return (sqlite3_backup_finish(backup) == SQLITE_OK);
+}
+
+static bool replace_file(const char* src, const char* dst)
+{
+#if defined(_WIN32)
+    return (MoveFileExA(src, dst, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0);
+#elif defined(__vita__)
+    /* sceIoRename() does not replace existing files */
+    sceIoRemove(dst);
+    return (sceIoRename(src, dst) >= 0);
+#else
+    return (rename(src, dst) == 0);
+#endif
+}
+
+/*
+ * Write an in-memory database out to a temporary file, sequentially, and then
+ * move that file over path, so that path is never left partially written.
+ */
+static bool persist_db(sqlite3* db, const char* path)
+{
+    char* tmp_path = malloc(strlen(path) + 5);
+    sqlite3* file_db = NULL;
+    bool r = false;
+
+    if (tmp_path == NULL) {
+        perr("Cannot allocate buffer\n");
+        return false;
+    }
+    sprintf(tmp_path, "%s.tmp", path);
+    remove(tmp_path);
+    if (sqlite3_open_v2(tmp_path, &file_db, SQLITE_OPEN_CREATE | SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK) {
+        perr("Cannot create database '%s'\n", tmp_path);
+        goto out;
+    }
+    /* The file is discarded on failure, so it needs no rollback journal */
+    sqlite3_exec(file_db, "PRAGMA journal_mode = OFF", NULL, NULL, NULL);
+    if (!backup_db(file_db, db)) {
+        perr("Cannot write database '%s': %s\n", tmp_path, sqlite3_errmsg(file_db));
+        goto out;
+    }
+    sqlite3_close(file_db);
+    file_db = NULL;
+    if (!replace_file(tmp_path, path)) {
+        perr("Cannot move '%s' to '%s'\n", tmp_path, path);
+        goto out;
+    }
+    r = true;
+
+out:
+    sqlite3_close(file_db);
+    if (!r)
+        remove(tmp_path);
+    free(tmp_path);
+    return r;
+}
+
+#define ADD_COUNTER(counter_name, counter_value) do {    \
+    counters[nb_counters].name = counter_name;          \
+    counters[nb_counters++].value = (int64_t)(counter_value); } while (0)
+
+/* Report the phases of the run, along with the license, cache and memory counters */
+static void print_stats(const phase_stats* phases, const zrif_scanner* sc, sqlite3* db,
+                        bool text, const char* json_path)
+{
+    static const struct { const char* name; int op; } db_status[] = {
+        { "sqlite_cache_used", SQLITE_DBSTATUS_CACHE_USED },
+        { "sqlite_cache_hit", SQLITE_DBSTATUS_CACHE_HIT },
+        { "sqlite_cache_miss", SQLITE_DBSTATUS_CACHE_MISS },
+        { "sqlite_cache_write", SQLITE_DBSTATUS_CACHE_WRITE },
+    };
+    stats_counter counters[16];
+    size_t nb_counters = 0;
+    unsigned long hits, misses;
+    int cur, high;
+    FILE* fd;
+
+    ADD_COUNTER("licenses_processed", sc->processed);
+    ADD_COUNTER("licenses_added", sc->added);
+    ADD_COUNTER("licenses_duplicate", sc->duplicate);
+    ADD_COUNTER("licenses_failed", sc->failed);
+    ADD_COUNTER("licenses_filtered", sc->filtered);
+    puff_cache_stats(&hits, &misses);
+    ADD_COUNTER("puff_cache_hits", hits);
+    ADD_COUNTER("puff_cache_misses", misses);
+    ADD_COUNTER("peak_rss", stats_peak_rss());
+    for (size_t i = 0; (db != NULL) && (i < sizeof(db_status) / sizeof(db_status[0])); i++) {
+        if (sqlite3_db_status(db, db_status[i].op, &cur, &high, 0) == SQLITE_OK)
+            ADD_COUNTER(db_status[i].name, cur);
+    }
+
+    if (text)
+        stats_print(stdout, false, phases, counters, nb_counters);
+    if (json_path == NULL)
+        return;
+    fd = (strcmp(json_path, "-") == 0) ? stdout : fopen(json_path, "w");
+    if (fd == NULL) {
+        perr("Cannot create '%s'\n", json_path);
+        return;
+    }
+    stats_print(fd, true, phases, counters, nb_counters);
+    if (fd != stdout)
+        fclose(fd);
+}
+
+typedef enum {
+    DOWNLOAD_OK,
+    DOWNLOAD_RETRY,             /* transient failure, such as a 429 or a dropped connection */
+    DOWNLOAD_FAILED,
+} download_result;
+
+/* What we learnt from a download attempt, for the next one */
+typedef struct {
+    int status;                 /* HTTP status of the last response, 0 if none */
+    int64_t retry_after;        /* ms, from the Retry-After header of the last response, -1 if none */
+    char etag[96], last_modified[96];
+    /* Validator of the data downloaded so far, sent as If-Range when resuming */
+    char validator[96];
+    bool restart;               /* the data downloaded so far can't be resumed */
+} download_state;
+
+static int64_t get_file_size(const char* path)
+{
+    int64_t size;
+    int fd = _open(path, _O_RDONLY | _O_BINARY);
+
+    if (fd <= 0)
+        return 0;
+    size = _lseek64(fd, 0, SEEK_END);
+    _close(fd);
+    return (size < 0) ? 0 : size;
+}
+
+/* Return the value of header line if it is called name (case insensitive), NULL otherwise */
+static const char* header_value(const char* line, const char* name)
+{
+    size_t len = strlen(name);
+
+    for (size_t i = 0; i < len; i++) {
+        if (tolower((unsigned char)line[i]) != tolower((unsigned char)name[i]))
+            return NULL;
+    }
+    if (line[len] != ':')
+        return NULL;
+    for (line = &line[len + 1]; (*line == ' ') || (*line == '\t'); line++);
+    return line;
+}
+
+/*
+ * Copy a header value, provided it is short and can safely be passed on to a shell command.
+ * Quotes are only accepted around the value, as for an ETag.
+ */
+static void copy_value(char* dst, size_t dst_size, const char* value)
+{
+    size_t len = strlen(value);
+
+    dst[0] = 0;
+    while ((len > 0) && isspace((unsigned char)value[len - 1]))
+        len--;
+    if (len >= dst_size)
+        return;
+    for (size_t i = 0; i < len; i++) {
+        if (value[i] == '"') {
+            if ((i != 0) && (i != len - 1))
+                return;
+        } else if (!isalnum((unsigned char)value[i]) && ((value[i] == 0) || (strchr(" ,:/+=._-", value[i]) == NULL))) {
+            return;
+        }
+    }
+    memcpy(dst, value, len);
+    dst[len] = 0;
+}
+
+/* Return the delay asked for by a Retry-After value, in seconds or as an HTTP date, in ms, or -1 */
+static int64_t parse_retry_after(const char* value)
+{
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    char month[4];
+    const char* p;
+    int64_t delay = 0, y, era, yoe, doy, days;
+    int day, m, year, hour, min, sec;
+
+    if (isdigit((unsigned char)*value)) {
+        for (; isdigit((unsigned char)*value) && (delay < RETRY_MAX_DELAY); value++)
+            delay = delay * 10 + (*value - '0');
+        return delay * 1000;
+    }
+    /* e.g. "Wed, 21 Oct 2015 07:28:00 GMT" */
+    if (sscanf(value, "%*3s, %d %3s %d %d:%d:%d", &day, month, &year, &hour, &min, &sec) != 6)
+        return -1;
+    p = strstr(months, month);
+    if ((strlen(month) != 3) || (p == NULL) || ((p - months) % 3 != 0))
+        return -1;
+    m = (int)(p - months) / 3 + 1;
+    /* Days from the epoch, in the proleptic Gregorian calendar */
+    y = year - (m <= 2);
+    era = ((y >= 0) ? y : y - 399) / 400;
+    yoe = y - era * 400;
+    doy = (153 * (m + ((m > 2) ? -3 : 9)) + 2) / 5 + day - 1;
+    days = era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+    delay = days * 86400 + hour * 3600 + min * 60 + sec - (int64_t)time(NULL);
+    return (delay < 0) ? 0 : delay * 1000;
+}
+
+/* Update the download state from a header line, or from the status line that starts each response */
+static void parse_header(download_state* st, const char* line)
+{
+    const char* value;
+
+    /* wget indents the headers it logs */
+    while ((*line == ' ') || (*line == '\t'))
+        line++;
+    if (strncmp(line, "HTTP/", 5) == 0) {
+        value = strchr(line, ' ');
+        st->status = (value != NULL) ? atoi(value) : 0;
+        st->retry_after = -1;
+        st->etag[0] = 0;
+        st->last_modified[0] = 0;
+    } else if ((value = header_value(line, "Retry-After")) != NULL) {
+        st->retry_after = parse_retry_after(value);
+    } else if ((value = header_value(line, "ETag")) != NULL) {
+        /* If-Range requires a strong validator */
+        if (value[0] == '"')
+            copy_value(st->etag, sizeof(st->etag), value);
+    } else if ((value = header_value(line, "Last-Modified")) != NULL) {
+        copy_value(st->last_modified, sizeof(st->last_modified), value);
+    }
+}
+
+/* Once data was received, what we have on disk is from the last response */
+static void keep_validator(download_state* st)
+{
+    if ((st->status == 200) || (st->status == 206))
+        strcpy(st->validator, (st->etag[0] != 0) ? st->etag : st->last_modified);
+}
+
+/* Whether the HTTP error of the last response is worth retrying */
+static download_result status_result(download_state* st)
+{
+    switch (st->status) {
+    case 416:
+        /* Range Not Satisfiable: start over */
+        st->restart = true;
+        return DOWNLOAD_RETRY;
+    case 408:
+    case 425:
+    case 429:
+    case 500:
+    case 502:
+    case 503:
+    case 504:
+        return DOWNLOAD_RETRY;
+    default:
+        return DOWNLOAD_FAILED;
+    }
+}
+
+/*
+ * How long to wait, in ms, after a number of failed attempts: what the server
+ * asked for, if anything, or an exponential backoff otherwise, with jitter so
+ * that concurrent downloads don't all retry at the same time. Returns -1 if the
+ * server wants us to wait for longer than RETRY_MAX_DELAY.
+ */
+static int64_t retry_delay(int attempts, int64_t retry_after)
+{
+    static per_thread uint32_t seed = 0;
+    int64_t delay = (int64_t)RETRY_BASE_DELAY << ((attempts > 16) ? 16 : attempts - 1);
+
+    if (seed == 0)
+        seed = (uint32_t)utime() | 1;
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    if (retry_after > RETRY_MAX_DELAY)
+        return -1;
+    if (retry_after >= 0)
+        return retry_after + seed % (RETRY_BASE_DELAY / 2);
+    if (delay > RETRY_MAX_DELAY)
+        delay = RETRY_MAX_DELAY;
+    return delay / 2 + seed % (delay / 2 + 1);
+}
+
+static download_result download_file(const char* url, const char* dest, download_state* st);
+
+/*
+ * Download url to dest, retrying transient failures, so that there are no more
+ * than MAX_DOWNLOAD_ATTEMPTS in all, including those already counted in
+ * attempts, and resuming broken transfers from where they left off, rather
+ * than starting over.
+ */
+static bool fetch_file(const char* url, const char* dest, int* attempts)
+{
+    download_state st;
+    download_result r;
+    int64_t delay;
+
+    memset(&st, 0, sizeof(st));
+    /* Whatever an earlier run may have left behind is not to be resumed */
+    remove(dest);
+    while (true) {
+        (*attempts)++;
+        r = download_file(url, dest, &st);
+        if (r != DOWNLOAD_RETRY)
+            return (r == DOWNLOAD_OK);
+        if (*attempts >= MAX_DOWNLOAD_ATTEMPTS) {
+            perr("Cannot download '%s' - Giving up after %d attempts\n", shorten_uri(url, SHORTEN_SIZE), *attempts);
+            return false;
+        }
+        delay = retry_delay(*attempts, st.retry_after);
+        if (delay < 0) {
+            perr("Server asks to retry in %lld s - Giving up\n", (long long)(st.retry_after / 1000));
+            return false;
+        }
+        if (st.restart) {
+            remove(dest);
+            st.validator[0] = 0;
+            st.restart = false;
+        }
+        printf("Retrying in %.1f s (attempt %d of %d)...\n", delay / 1000.0, *attempts + 1, MAX_DOWNLOAD_ATTEMPTS);
+        msleep((int)delay);
+    }
+}
+
+#if defined(__vita__)
+static void http_init()
+{
+    const int size = 4 * 1024 * 1024;
+    sceSysmoduleLoadModule(SCE_SYSMODULE_NET);
+    sceSysmoduleLoadModule(SCE_SYSMODULE_HTTP);
+    SceNetInitParam netInitParam;
+    netInitParam.memory = malloc(size);
+    netInitParam.size = size;
+    netInitParam.flags = 0;
+    sceNetInit(&netInitParam);
+    sceNetCtlInit();
+    sceHttpInit(size);
+}
+
+static void http_exit()
+{
+    sceHttpTerm();
+    sceNetCtlTerm();
+    sceNetTerm();
+    sceSysmoduleUnloadModule(SCE_SYSMODULE_HTTP);
+    sceSysmoduleUnloadModule(SCE_SYSMODULE_NET);
+}
+
+static int curl_progress_function(void *p, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+{
+    static uint64_t last_tick = 0ULL;
+    uint64_t cur_tick;
+
+    /* Ensure that at least 200 ms have elapsed since last progress */
+    cur_tick = utime();
+    if (cur_tick - last_tick < REFRESH_STEP)
+        return 0;
+    last_tick = cur_tick;
+    printf("\rDownloaded %s", size_to_human_readable(dlnow));
+    return 0;
+}
+
+static size_t curl_write_function(void *ptr, size_t size, size_t nmemb, void *stream)
+{
+    int written = sceIoWrite(*(int*)stream, ptr, size * nmemb);
+    if (written < 0) {
+        perr("Error writing file: 0x%08X\n", (uint32_t)written);
+        return 0;
+    }
+    return (size_t)written;
+}
+
+static size_t curl_header_function(char *buffer, size_t size, size_t nitems, void *userdata)
+{
+    char line[256];
+    size_t len = size * nitems;
+
+    if (len < sizeof(line)) {
+        memcpy(line, buffer, len);
+        line[len] = 0;
+        parse_header((download_state*)userdata, line);
+    }
+    return size * nitems;
+}
+
+static download_result download_file(const char *url, const char *dest, download_state *st)
+{
+    int fd = 0;
+    int64_t offset = get_file_size(dest);
+    char if_range[128];
+    CURL *curl = NULL;
+    CURLcode r = CURLE_RECV_ERROR;
+    struct curl_slist *headers = NULL;
+    download_result result = DOWNLOAD_FAILED;
+
+    http_init();
+
+    if (offset > 0)
+        printf("Resuming download of '%s' from %s...\n", shorten_uri(url, SHORTEN_SIZE), size_to_human_readable(offset));
+    else
+        printf("Downloading '%s'...\n", shorten_uri(url, SHORTEN_SIZE));
+
+    curl = curl_easy_init();
+    if (curl == NULL) {
+        perr("Could not open initialize download\n");
+        goto out;
+    }
+
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "Vitali/" VERSION " (libcur/" LIBCURL_VERSION ")");
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+    /* We need TLS 1.2 support for nopaystation.com */
+    curl_easy_setopt(curl, CURLOPT_SSLVERSION, CURL_SSLVERSION_TLSv1_2);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 20L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, (long)STALL_TIMEOUT);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    /* Don't write error pages, which would then be mistaken for (part of) the data */
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_function);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, curl_header_function);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, st);
+    /* Set Curl to display some progress */
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, curl_progress_function);
+    if (offset > 0) {
+        curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, (curl_off_t)offset);
+        /* Only resume if the data hasn't changed in the meantime */
+        if (st->validator[0] != 0) {
+            snprintf(if_range, sizeof(if_range), "If-Range: %s", st->validator);
+            headers = curl_slist_append(headers, if_range);
+            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        }
+    }
+    fd = sceIoOpen(dest, SCE_O_WRONLY | SCE_O_CREAT | ((offset > 0) ? SCE_O_APPEND : SCE_O_TRUNC), 0777);
+    if (fd < 0) {
+        perr("Could not open file '%s'\n", dest);
+        goto out;
+    }
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &fd);
+
+    st->status = 0;
+    st->retry_after = -1;
+    r = curl_easy_perform(curl);
+    switch (r) {
+    case CURLE_OK:
+        result = DOWNLOAD_OK;
+        break;
+    case CURLE_HTTP_RETURNED_ERROR:
+        result = status_result(st);
+        break;
+    case CURLE_RANGE_ERROR:
+    case CURLE_BAD_DOWNLOAD_RESUME:
+        /* The server can't resume, or the data has changed */
+        st->restart = true;
+        result = DOWNLOAD_RETRY;
+        break;
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_PARTIAL_FILE:
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_SSL_CONNECT_ERROR:
+    case CURLE_GOT_NOTHING:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+        result = DOWNLOAD_RETRY;
+        break;
+    default:
+        break;
+    }
+    if (!st->restart)
+        keep_validator(st);
+    if (r != CURLE_OK) {
+        perr("\nCould not download file: %s\n", curl_easy_strerror(r));
+        goto out;
+    }
+    printf("\n");
+
+out:
+    if (fd > 0)
+        sceIoClose(fd);
+    if (curl != NULL)
+        curl_easy_cleanup(curl);
+    curl_slist_free_all(headers);
+    http_exit();
+    return result;
+}
+#else
+static int exit_code(int ret)
+{
+#if defined(_WIN32)
+    return ret;
+#else
+    return ((ret != -1) && WIFEXITED(ret)) ? WEXITSTATUS(ret) : -1;
+#endif
+}
+
+/* Parse the headers that curl dumped or wget logged, or that our script saved */
+static void read_headers(download_state* st, const char* path)
+{
+    char line[256];
+    FILE* fd = fopen(path, "r");
+
+    st->status = 0;
+    st->retry_after = -1;
+    if (fd == NULL)
+        return;
+    while (fgets(line, sizeof(line), fd) != NULL)
+        parse_header(st, line);
+    fclose(fd);
+}
+
+/* Work out what to do next from the exit code of the download command */
+static download_result command_result(const char* cmd, int code, download_state* st)
+{
+    if (code == 0)
+        return DOWNLOAD_OK;
+    if (strcmp(cmd, "cscript") == 0) {
+        /* Our script exits with the HTTP status, or 1 if the request itself failed */
+        if (code >= 400) {
+            st->status = code;
+            return status_result(st);
+        }
+        return DOWNLOAD_RETRY;
+    }
+    if (strcmp(cmd, "wget") == 0) {
+        switch (code) {
+        case 4:     /* network failure */
+        case 7:     /* protocol error */
+            return DOWNLOAD_RETRY;
+        case 8:     /* server error response */
+            return status_result(st);
+        default:
+            return DOWNLOAD_FAILED;
+        }
+    }
+    switch (code) {
+    case 22:        /* HTTP error */
+        return status_result(st);
+    case 33:        /* range error */
+    case 36:        /* bad download resume */
+        st->restart = true;
+        return DOWNLOAD_RETRY;
+    case 6:         /* could not resolve host */
+    case 7:         /* could not connect */
+    case 16:        /* HTTP/2 error */
+    case 18:        /* partial file */
+    case 28:        /* timeout */
+    case 35:        /* SSL connect error */
+    case 52:        /* empty reply */
+    case 55:        /* send error */
+    case 56:        /* receive error */
+    case 92:        /* HTTP/2 stream error */
+        return DOWNLOAD_RETRY;
+    default:
+        return DOWNLOAD_FAILED;
+    }
+}
+
+static download_result download_file(const char* url, const char* file, download_state* st)
+{
+    static bool no_curl = false;
+    bool use_vbscript = USE_VBSCRIPT_DOWNLOAD;
+    const char* tool = use_vbscript ? "cscript" : (no_curl ? "wget" : "curl");
+    /* Room for the validator with each of its characters escaped, even though only two quotes can be */
+    char vbs_tmp[256], hdr_tmp[256], if_range[2 * sizeof(st->validator) + 24] = "";
+    char cmd[2048];
+    int64_t offset = get_file_size(file);
+    download_result result;
+    int code;
+
+    /* Each concurrent download gets its own script and headers */
+    snprintf(vbs_tmp, sizeof(vbs_tmp), "%s.vbs", file);
+    snprintf(hdr_tmp, sizeof(hdr_tmp), "%s.hdr", file);
+    if (use_vbscript) {
+        FILE *vbs_fd = fopen(vbs_tmp, "w");
+        if (vbs_fd != NULL) {
+            fwrite(vbs, 1, sizeof(vbs) - 1, vbs_fd);
+            fclose(vbs_fd);
+        }
+    }
+
+    /* The validator, which only holds characters that are safe for the shell, needs its quotes escaped */
+    if ((offset > 0) && (st->validator[0] != 0)) {
+        size_t len = (size_t)snprintf(if_range, sizeof(if_range), " --header \"If-Range: ");
+        for (const char* p = st->validator; *p != 0; p++) {
+            if (*p == '"')
+                if_range[len++] = '\\';
+            if_range[len++] = *p;
+        }
+        strcpy(&if_range[len], "\"");
+    }
+
+    if (offset > 0)
+        printf("Resuming download of '%s' from %s...\n", shorten_uri(url, SHORTEN_SIZE), size_to_human_readable(offset));
+    else
+        printf("Downloading '%s'...\n", shorten_uri(url, SHORTEN_SIZE));
+
+    fflush(stdout);
+    remove(hdr_tmp);
+    /* Error pages are not written to the file, so that what we have can always be resumed */
+    if (use_vbscript)
+        snprintf(cmd, sizeof(cmd), "cscript //nologo %s \"%s\" %s %s", vbs_tmp, url, file, hdr_tmp);
+    else if (!no_curl)
+        snprintf(cmd, sizeof(cmd), "curl -L -f --connect-timeout 20 --speed-limit 1 --speed-time %d -C - -D %s%s -o %s \"%s\"",
+            STALL_TIMEOUT, hdr_tmp, if_range, file, url);
+    else
+        snprintf(cmd, sizeof(cmd), "wget -S -c --tries=1 --connect-timeout=20 --read-timeout=%d -o %s%s -O %s \"%s\"",
+            STALL_TIMEOUT, hdr_tmp, if_range, file, url);
+    code = exit_code(system(cmd));
+    if (!use_vbscript && !no_curl && ((code == 127) || (code == 9009))) {
+        /* No curl, so try wget instead */
+        no_curl = true;
+        return download_file(url, file, st);
+    }
+    read_headers(st, hdr_tmp);
+    result = command_result(tool, code, st);
+    if (!st->restart)
+        keep_validator(st);
+    if (code != 0)
+        printf("Cannot download file - Error %d\n", code);
+    remove(hdr_tmp);
+    if (use_vbscript)
+        remove(vbs_tmp);
+    return result;
+}
+#endif
+
+/*
+ * List the members of an XLSX file that we want to scan. They are only inflated
+ * once we get to scan them, through a sliding window, so that the XML is never
+ * held in memory as a whole.
+ */
+static bool unzip_source(zrif_source* src, phase_stats* phases)
+{
+    stats_mark mark;
+
+    /* Assume that we are dealing with a .xlsx file */
+    printf("Parsing XLSX file...\n");
+    stats_begin(&mark);
+    src->members = malloc(MAX_XLSX_MEMBERS * sizeof(zip_member));
+    if (src->members == NULL) {
+        perr("Cannot allocate buffer\n");
+        return false;
+    }
+    src->nb_members = zip_list((const uint8_t*)src->buf, src->size, is_xlsx_text_member,
+        src->members, MAX_XLSX_MEMBERS);
+    if (src->nb_members < 0) {
+        perr("Could not read the central directory of XLSX file\n");
+        return false;
+    }
+    if (src->nb_members == 0) {
+        perr("Could not find '%s' in XLSX file\n", xlsx_shared_strings);
+        return false;
+    }
+    src->xml_size = 0;
+    for (int i = 0; i < src->nb_members; i++)
+        src->xml_size += src->members[i].uncompressed_size;
+    stats_end(&phases[PHASE_UNZIP], &mark, src->xml_size, src->nb_members);
+    return true;
+}
+
+/* Last modification time of a file, in whatever unit the platform uses, or 0 if unknown */
+static uint64_t file_mtime(const char* path)
+{
+#if defined(_WIN32)
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &attr))
+        return 0;
+    return ((uint64_t)attr.ftLastWriteTime.dwHighDateTime << 32) | attr.ftLastWriteTime.dwLowDateTime;
+#elif defined(__vita__)
+    SceIoStat st;
+    SceRtcTick tick;
+    if ((sceIoGetstat(path, &st) < 0) || (sceRtcGetTick(&st.st_mtime, &tick) < 0))
+        return 0;
+    return tick.tick;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return 0;
+    return (uint64_t)st.st_mtime;
+#endif
+}
+
+/* Read size bytes, in chunks that the 32-bit read() APIs can cope with */
+static bool read_fully(int fd, char* buf, size_t size)
+{
+    int n;
+
+    while (size > 0) {
+        n = _read(fd, buf, (size > READ_CHUNK_SIZE) ? READ_CHUNK_SIZE : (unsigned)size);
+        if (n <= 0)
+            return false;
+        buf += n;
+        size -= n;
+    }
+    return true;
+}
+
+/*
+ * Read the start of a source that we don't want to hold in memory (stdin or a
+ * large file), to work out its format. Text is then scanned as it arrives, one
+ * read at a time, but compressed data and XLSX files need to be read in full,
+ * as neither puff() nor the ZIP central directory allow for piecewise
+ * processing. file_size is 0 if unknown.
+ */
+static bool load_stream(zrif_source* src, uint64_t file_size)
+{
+    size_t max_size = STDIN_CHUNK_SIZE;
+    int n = 0;
+    bool read_all;
+    char* new_buf;
+    stats_mark mark;
+
+    stats_begin(&mark);
+    src->buf = malloc(max_size + 16);
+    if (src->buf == NULL) {
+        perr("Cannot allocate buffer\n");
+        return false;
+    }
+    src->buf[0] = 0;
+    src->buf[1] = 0;
+    /* Don't wait for more than what the format can be told from, so that scanning starts right away */
+    while ((src->size < SNIFF_TEXT_SIZE) && ((n = _read(src->fd, &src->buf[src->size], (unsigned)(max_size - src->size))) > 0))
+        src->size += n;
+    src->format = sniff_format(src->buf, src->size);
+    read_all = (src->format == FORMAT_XLSX) || is_compressed(src->format);
+    if (read_all && (file_size != 0)) {
+        if (file_size > SIZE_MAX - 16) {
+            perr("'%s' is too large\n", src->uri);
+            return false;
+        }
+        new_buf = realloc(src->buf, (size_t)file_size + 16);
+        if (new_buf == NULL) {
+            perr("Cannot allocate buffer\n");
+            return false;
+        }
+        src->buf = new_buf;
+        if (!read_fully(src->fd, &src->buf[src->size], (size_t)file_size - src->size)) {
+            perr("Cannot read from '%s'\n", src->uri);
+            return false;
+        }
+        src->size = (size_t)file_size;
+        n = 0;
+    } else if (read_all) {
+        while (n > 0) {
+            if (src->size == max_size) {
+                max_size *= 2;
+                new_buf = realloc(src->buf, max_size + 16);
+                if (new_buf == NULL) {
+                    perr("Cannot allocate buffer\n");
+                    return false;
                 }
-            } else {
-                added++;
+                src->buf = new_buf;
             }
-        } else {
+            n = _read(src->fd, &src->buf[src->size], (unsigned)(max_size - src->size));
+            if (n > 0)
+                src->size += n;
+        }
+    }
+    if (n < 0) {
+        perr("Cannot read from '%s'\n", src->uri);
+        return false;
+    }
+    /* Still more to come unless the end was reached */
+    src->is_stream = (n > 0);
+    if (!src->is_stream && (src->size < 16)) {
+        perr("Size of '%s' is too small\n", src->uri);
+        return false;
+    }
+    src->buf[src->size] = 0;
+    src->buf[src->size + 1] = 0;
+    stats_end(&src->phases[PHASE_READ], &mark, src->size, 1);
+
+    if (src->is_stream)
+        return true;
+    if (src->use_cache) {
+        stats_begin(&mark);
+        src->hash = rif_cache_hash((uint8_t*)src->buf, src->size);
+        stats_end(&src->phases[PHASE_CACHE], &mark, src->size, 1);
+    }
+    if ((src->format == FORMAT_XLSX) && !src->use_cache && !unzip_source(src, src->phases))
+        return false;
+    return true;
+}
+
+/* List the .rif files of a directory source, which are only read while scanning */
+static bool load_rif_dir(zrif_source* src)
+{
+    stats_mark mark;
+
+    src->format = FORMAT_RIF_DIR;
+    stats_begin(&mark);
+    if (!rif_dir_list(&src->dir, src->uri, 0)) {
+        perr("Cannot read directory '%s'\n", src->uri);
+        return false;
+    }
+    stats_end(&src->phases[PHASE_READ], &mark, 0, src->dir.count);
+    if (src->dir.unreadable != 0)
+        perr("Could not read %u director%s of '%s'\n", src->dir.unreadable,
+            (src->dir.unreadable == 1) ? "y" : "ies", src->uri);
+    return true;
+}
+
+/*
+ * Download and read a source, following Google spreadsheet redirects, and
+ * work out its format. As sources are loaded concurrently, all the state
+ * lives in src.
+ */
+static bool load_source(zrif_source* src)
+{
+    int fd = 0;
+    int64_t file_size;
+    bool r = false;
+    stats_mark mark;
+
+    if (strcmp(src->uri, "-") == 0) {
+#if defined(__vita__)
+        perr("Reading from stdin is not supported on the Vita\n");
+        return false;
+#else
+#if defined(_WIN32)
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        src->fd = 0;
+        return load_stream(src, 0);
+#endif
+    }
+    if ((strncmp(src->uri, "http", 4) != 0) && rif_dir_exists(src->uri))
+        return load_rif_dir(src);
+
+retry:
+    if (strncmp(src->uri, "http", 4) == 0) {
+        /* uri may point into buf, which is about to be replaced */
+        if (src->uri != src->url) {
+            free(src->url);
+            src->url = strdup(src->uri);
+        }
+        stats_begin(&mark);
+        if ((src->url == NULL) || !fetch_file(src->url, src->tmp_path, &src->attempts))
+            goto out;
+        src->uri = src->tmp_path;
+        stats_end(&src->phases[PHASE_DOWNLOAD], &mark, 0, 1);
+    } else if (src->use_cache) {
+        src->mtime = file_mtime(src->uri);
+    }
+
+    stats_begin(&mark);
+    fd = _open(src->uri, _O_RDONLY | _O_BINARY);
+    if (fd <= 0) {
+        perr("Cannot open file '%s'\n", src->uri);
+        goto out;
+    }
+
+    file_size = _lseek64(fd, 0, SEEK_END);
+    if (file_size < 16) {
+        perr("Size of '%s' is too small\n", src->uri);
+        goto out;
+    }
+
+    _lseek64(fd, 0, SEEK_SET);
+
+    /* Large text files are scanned straight from the file, rather than from memory */
+    if (file_size > MAX_BUFFERED_SIZE) {
+        src->fd = fd;
+        fd = 0;
+        return load_stream(src, (uint64_t)file_size);
+    }
+
+    free(src->buf);
+    src->size = (size_t)file_size;
+    /* Allow some extra space in case the redirect URL is at the very end of our buffer */
+    src->buf = malloc(src->size + 16);
+    if (src->buf == NULL) {
+        perr("Cannot allocate buffer\n");
+        goto out;
+    }
+    if (!read_fully(fd, src->buf, src->size)) {
+        perr("Cannot read from '%s'\n", src->uri);
+        goto out;
+    }
+    src->buf[src->size] = 0;
+    src->buf[src->size + 1] = 0;
+    stats_end(&src->phases[PHASE_READ], &mark, src->size, 1);
+    if (src->url != NULL)
+        src->phases[PHASE_DOWNLOAD].bytes += src->size;
+
+    if (src->use_cache) {
+        stats_begin(&mark);
+        src->hash = rif_cache_hash((uint8_t*)src->buf, src->size);
+        stats_end(&src->phases[PHASE_CACHE], &mark, src->size, 1);
+    }
+
+    /* Compressed data is decompressed on the fly, while scanning */
+    src->format = sniff_format(src->buf, src->size);
+    if ((src->format == FORMAT_XLSX) && !src->use_cache && !unzip_source(src, src->phases))
+        goto out;
+    if (src->format == FORMAT_HTML) {
+        /* Error and redirect pages are small, so the link is expected near the top */
+        char *window_end = &src->buf[(src->size > SNIFF_WINDOW) ? SNIFF_WINDOW : src->size], *p, *q = NULL;
+        if ((src->url != NULL) && (find_str(src->buf, window_end - src->buf, "<title>Too Many Requests</title>") != NULL)) {
+            /* Google spreadsheet may return a "Too Many Requests" page, rather than a 429 */
+            int64_t delay = retry_delay(src->attempts, -1);
+            safe_close(fd);
+            remove(src->tmp_path);
+            if (src->attempts >= MAX_DOWNLOAD_ATTEMPTS) {
+                perr("Too many requests - Giving up after %d attempts\n", src->attempts);
+                goto out;
+            }
+            printf("Too many requests - Retrying in %.1f s...\n", delay / 1000.0);
+            msleep((int)delay);
+            src->uri = src->url;
+            goto retry;
+        }
+        p = find_str(src->buf, window_end - src->buf, GOOGLE_SHEETS_URL);
+        if (p != NULL)
+            q = find_str(p, window_end - p, "/edit'");
+        if (q != NULL) {
+            safe_close(fd);
+            remove(src->tmp_path);
+            strcpy(q, "/export?format=xlsx");
+            src->uri = p;
+            /* This is a new download, with attempts of its own */
+            src->attempts = 0;
+            goto retry;
+        }
+    }
+    r = true;
+
+out:
+    safe_close(fd);
+    return r;
+}
+
+static THREAD_FUNC(load_worker)
+{
+    zrif_source* src = (zrif_source*)arg;
+
+    src->ok = load_source(src);
+    THREAD_RETURN;
+}
+
+/* Load all the sources concurrently, except on the Vita, where downloads can't overlap */
+static bool load_sources(zrif_source* sources, int nb_sources)
+{
+    thread_t threads[MAX_SOURCES];
+    bool started[MAX_SOURCES] = { false };
+    bool r = true;
+    int i;
+
 #if !defined(__vita__)
-            perr("\nCannot decode zRIF: %s\n", zrif);
+    for (i = 0; (nb_sources > 1) && (i < nb_sources); i++)
+        started[i] = thread_create(&threads[i], load_worker, &sources[i]);
 #endif
-            failed++;
+    for (i = 0; i < nb_sources; i++) {
+        if (started[i])
+            thread_join(threads[i]);
+        else
+            sources[i].ok = load_source(&sources[i]);
+        r = r && sources[i].ok;
+    }
+    return r;
+}
+
+static void print_usage(void)
+{
+    printf("\nUsage: vitali [--memory] [--cache FILE] [--prefer first|last] [--column NAME] [--stats]\n");
+    printf("              [--stats-json FILE] [--no-progress] [--filter LIST] [ZRIF_URI] [ZRIF_URI...] [DB_FILE]\n");
+    printf("       vitali --check [--column NAME] [ZRIF_URI...]\n");
+    printf("       vitali --export [CSV_FILE] [DB_FILE]\n");
+    printf("       vitali --export-rif [DIR] [DB_FILE]\n");
+}
+
+/* Options that must be followed by a value */
+static bool takes_value(const char* option)
+{
+    static const char* options[] = { "--cache", "--filter", "--column", "--stats-json", "--prefer" };
+
+    for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+        if (strcmp(option, options[i]) == 0)
+            return true;
+    }
+    return false;
+}
+
+int main(int argc, char** argv)
+{
+    int ret = 1, rc, nb_args = 0, nb_sources = 0;
+    int fd = 0;
+    bool unknown_total = false, initialize_db = false, needs_keypress = separate_console();
+    bool export = false, export_rif = false, check = false, stats = false, progress = true, in_memory = false, use_cache = false;
+    bool prefer_last = false, scan_failed = false;
+    char *db_path = LICENSE_DB_PATH;
+    char *export_path = EXPORT_PATH;
+    char *args[MAX_SOURCES + 1];
+    char *errmsg = NULL;
+    char *stats_json = NULL;
+    char *cache_path = NULL;
+    char *csv_column = NULL;
+    sqlite3 *db = NULL, *file_db = NULL;
+    zrif_scanner scanner;
+    rif_cache cache;
+    zrif_source sources[MAX_SOURCES];
+    content_filter filter;
+    uint64_t source_size = 0, source_hash = 0, input_size = 0;
+    phase_stats phases[PHASE_MAX];
+    stats_mark run, mark;
+
+#if defined(__vita__)
+    SceCtrlData pad;
+    init_video();
+    console_init();
+    sceSysmoduleLoadModule(SCE_SYSMODULE_SQLITE);
+    sqlite3_rw_init();
+#endif
+
+    printf("Vitali v" VERSION " - Vita License database updater\n");
+    printf("Copyright (c) 2017-2018 VitaSmith (GPLv3)\n\n");
+
+    memset(phases, 0, sizeof(phases));
+    memset(&scanner, 0, sizeof(scanner));
+    memset(sources, 0, sizeof(sources));
+    filter_init(&filter);
+    /* Before any source is loaded or scanned by another thread */
+    zip_init();
+    stats_begin(&run);
+
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-v") == 0) || (strcmp(argv[i], "--version") == 0)) {
+            printf("\nVisit https://github.com/VitaSmith/vitali for the source\n");
+            goto out;
+        }
+        if ((strcmp(argv[i], "-h") == 0) || (strcmp(argv[i], "--help") == 0)) {
+            print_usage();
+            goto out;
+        }
+        if (takes_value(argv[i]) && (i + 1 >= argc)) {
+            perr("%s requires a value\n", argv[i]);
+            print_usage();
+            goto out;
+        }
+        if (strcmp(argv[i], "--export") == 0) {
+            export = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--export-rif") == 0) {
+            export_rif = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--check") == 0) {
+            check = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--memory") == 0) {
+            in_memory = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--no-progress") == 0) {
+            progress = false;
+            continue;
+        }
+        if (strcmp(argv[i], "--stats") == 0) {
+            stats = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--cache") == 0) {
+            cache_path = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--filter") == 0) {
+            if (!filter_add(&filter, argv[++i])) {
+                perr("Invalid filter '%s'\n", argv[i]);
+                goto out;
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--column") == 0) {
+            csv_column = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--stats-json") == 0) {
+            stats_json = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--prefer") == 0) {
+            i++;
+            if ((strcmp(argv[i], "first") != 0) && (strcmp(argv[i], "last") != 0)) {
+                perr("--prefer must be 'first' or 'last'\n");
+                goto out;
+            }
+            prefer_last = (strcmp(argv[i], "last") == 0);
+            continue;
+        }
+        if (nb_args > MAX_SOURCES) {
+            perr("Too many sources (max %d)\n", MAX_SOURCES);
+            goto out;
+        }
+        args[nb_args++] = argv[i];
+    }
+
+    if (export || export_rif) {
+        if (export_rif)
+            export_path = EXPORT_RIF_PATH;
+        if (nb_args > 0)
+            export_path = args[0];
+        if (nb_args > 1)
+            db_path = args[1];
+        rc = sqlite3_open_v2(db_path, &db, SQLITE_OPEN_READONLY, NULL);
+        if (rc != SQLITE_OK) {
+            perr("Cannot open database '%s'\n", db_path);
+            goto out;
+        }
+        if (export_rif)
+            ret = export_rifs(db, export_path) ? 0 : 1;
+        else
+            ret = export_zrifs(db, export_path) ? 0 : 1;
+        goto out;
+    }
+
+    /* The database comes last, after one or more sources, except for --check */
+    if (!check && (nb_args > 1))
+        db_path = args[--nb_args];
+    if (nb_args > MAX_SOURCES) {
+        perr("Too many sources (max %d)\n", MAX_SOURCES);
+        goto out;
+    }
+    if (nb_args == 0)
+        args[nb_args++] = ZRIF_URI;
+    for (int i = 0, nb_stdin = 0; i < nb_args; i++) {
+        if ((strcmp(args[i], "-") == 0) && (++nb_stdin > 1)) {
+            perr("Only one source can be read from stdin\n");
+            goto out;
+        }
+    }
+    /* Sources are processed in order of precedence, and the first license seen wins */
+    nb_sources = nb_args;
+    for (int i = 0; i < nb_sources; i++) {
+        zrif_source* src = &sources[prefer_last ? nb_sources - 1 - i : i];
+        src->uri = args[i];
+        if (nb_sources == 1)
+            snprintf(src->tmp_path, sizeof(src->tmp_path), "%s", ZRIF_TMP_PATH);
+        else
+            snprintf(src->tmp_path, sizeof(src->tmp_path), "%s.%d", ZRIF_TMP_PATH, i);
+        src->use_cache = (cache_path != NULL) && !check;
+    }
+
+    if (!load_sources(sources, nb_sources))
+        goto out;
+    for (int i = 0; i < nb_sources; i++) {
+        stats_merge(phases, sources[i].phases);
+        /* There's no way to tell whether a stream matches a cache before consuming it */
+        if (sources[i].is_stream && (cache_path != NULL)) {
+            printf("Streaming '%s' - Ignoring --cache\n", sources[i].uri);
+            cache_path = NULL;
+        }
+        /* Nor a directory, short of reading every file, which is what the cache is meant to avoid */
+        if ((sources[i].format == FORMAT_RIF_DIR) && (cache_path != NULL)) {
+            printf("Reading directory '%s' - Ignoring --cache\n", sources[i].uri);
+            cache_path = NULL;
         }
-        zrif += zrif_len + 1;
     }
 
+    /* A cache created from these very sources saves us from having to parse them */
+    if ((cache_path != NULL) && !check) {
+        uint64_t keys[3 * MAX_SOURCES];
+        for (int i = 0; i < nb_sources; i++) {
+            keys[3 * i] = (uint64_t)sources[i].size;
+            keys[3 * i + 1] = sources[i].hash;
+            keys[3 * i + 2] = sources[i].mtime;
+            source_size += (uint64_t)sources[i].size;
+        }
+        source_hash = rif_cache_hash((uint8_t*)keys, 3 * nb_sources * sizeof(uint64_t));
+        stats_begin(&mark);
+        use_cache = rif_cache_open(&cache, cache_path, source_size, source_hash);
+        stats_end(&phases[PHASE_CACHE], &mark, 0, 0);
+    }
+
+    if (use_cache) {
+        printf("Using decoded licenses from '%s'...\n", cache_path);
+    } else {
+        for (int i = 0; i < nb_sources; i++) {
+            if ((sources[i].format == FORMAT_XLSX) && (sources[i].members == NULL) && !unzip_source(&sources[i], phases))
+                goto out;
+            /* Neither the size of compressed data nor that of a stream tell how much there is to scan */
+            unknown_total |= is_compressed(sources[i].format) || sources[i].is_stream ||
+                (sources[i].format == FORMAT_RIF_DIR);
+            input_size += (sources[i].format == FORMAT_XLSX) ? sources[i].xml_size : (uint64_t)sources[i].size;
+        }
+    }
+
+    if (check) {
+        scanner_init(&scanner, NULL, NULL);
+        scanner.show_progress = progress;
+        if (csv_column != NULL)
+            scanner.csv_column = csv_column;
+        scanner.total = unknown_total ? 0 : input_size;
+        stats_begin(&mark);
+        ret = check_zrifs(&scanner, sources, nb_sources) ? 0 : 1;
+        for (int i = 0; i < nb_sources; i++)
+            input_size += sources[i].streamed;
+        stats_end(&phases[PHASE_SCAN], &mark, input_size, scanner.processed);
+        stats_end(&phases[PHASE_TOTAL], &run, 0, 0);
+        if (stats || (stats_json != NULL))
+            print_stats(phases, &scanner, NULL, stats, stats_json);
+        goto out;
+    }
+
+    fd = _open(db_path, _O_RDONLY);
+    if (fd > 0) {
+        if (_lseek(fd, 0, SEEK_END) == 0) {
+            printf("Removing stale database '%s'...\n", db_path);
+            safe_close(fd);
+            remove(db_path);
+            initialize_db = true;
+        } else {
+            safe_close(fd);
+        }
+    } else {
+        initialize_db = true;
+    }
+
+    if (in_memory) {
+        /* Build the database in memory, starting from the existing one if any */
+        rc = sqlite3_open(":memory:", &db);
+        if (rc != SQLITE_OK) {
+            perr("Cannot create in-memory database\n");
+            goto out;
+        }
+        if (!initialize_db) {
+            stats_begin(&mark);
+            if ((sqlite3_open_v2(db_path, &file_db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) ||
+                !backup_db(db, file_db)) {
+                perr("Cannot read database '%s': %s\n", db_path, sqlite3_errmsg(file_db));
+                goto out;
+            }
+            sqlite3_close(file_db);
+            file_db = NULL;
+            stats_end(&phases[PHASE_SEED], &mark, 0, 1);
+        }
+    } else {
+        rc = sqlite3_open_v2(db_path, &db, SQLITE_OPEN_CREATE | SQLITE_OPEN_READWRITE, NULL);
+        if (rc != SQLITE_OK) {
+            perr("Cannot open database '%s'\n", db_path);
+            goto out;
+        }
+    }
+
+    if (initialize_db) {
+        rc = sqlite3_exec(db, schema, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) {
+            perr("Cannot set database schema\n");
+            goto out;
+        }
+    }
+
+    rc = sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, &errmsg);
+    if (rc != SQLITE_OK) {
+        perr("Cannot create transaction: %s\n", errmsg);
+        goto out;
+    }
+
+    scanner_init(&scanner, db, (stats || (stats_json != NULL)) ? phases : NULL);
+    scanner.show_progress = progress;
+    if (filter_is_set(&filter))
+        scanner.filter = &filter;
+    if (csv_column != NULL)
+        scanner.csv_column = csv_column;
+    /* The size of compressed or streamed input is not that of the data being scanned */
+    scanner.total = unknown_total ? 0 : input_size;
+    if (use_cache) {
+        scanner.total = ((const rif_cache_header*)cache.base)->data_size;
+    } else if (cache_path != NULL) {
+        scanner.cache = rif_cache_writer_create();
+        if (scanner.cache == NULL)
+            perr("Cannot allocate cache - Disabling cache\n");
+    }
+    stats_begin(&mark);
+    if (use_cache) {
+        add_cached_rifs(&scanner, &cache);
+    } else {
+        /*
+         * Only the loading is concurrent: the zRIFs are decoded and inserted
+         * here, one source after the other, in order of precedence, as the
+         * duplicate lookup and the inserts go through a single connection.
+         */
+        for (int i = 0; i < nb_sources; i++) {
+            if (!scan_source(&scanner, &sources[i])) {
+                scan_failed = true;
+                break;
+            }
+            input_size += sources[i].streamed;
+        }
+    }
+    stats_end(&phases[PHASE_SCAN], &mark, use_cache ? scanner.total : input_size, scanner.processed);
+    scanner_exit(&scanner);
+    end_progress(&scanner);
+    /* Don't commit a partial import, which could be mistaken for a complete one */
+    if (scan_failed) {
+        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+        perr("Not all the licenses could be read - No license was added to '%s'\n", db_path);
+        goto out;
+    }
+
+    stats_begin(&mark);
     rc = sqlite3_exec(db, "COMMIT", NULL, NULL, &errmsg);
     if (rc != SQLITE_OK) {
         perr("\nCannot commit transaction: %s\n", errmsg);
         goto out;
     }
+    stats_end(&phases[PHASE_COMMIT], &mark, 0, 1);
+
+    /* Leave the existing file alone if there was nothing new to add */
+    if (in_memory && (initialize_db || sqlite3_total_changes(db) > 0)) {
+        stats_begin(&mark);
+        if (!persist_db(db, db_path))
+            goto out;
+        stats_end(&phases[PHASE_PERSIST], &mark, 0, 1);
+    }
 
-    printf("\rProcessed %d licenses:\n %d added, %d duplicate(s), %d failed.\n", processed, added, duplicate, failed);
+    if (scanner.cache != NULL) {
+        stats_begin(&mark);
+        if (rif_cache_write(scanner.cache, cache_path, source_size, source_hash))
+            printf("Decoded licenses were saved to '%s'.\n", cache_path);
+        else
+            perr("Cannot write cache '%s'\n", cache_path);
+        stats_end(&phases[PHASE_CACHE], &mark, 0, 1);
+    }
+
+    printf("\rProcessed %d licenses:\n %d added, %d duplicate(s), %d failed", scanner.processed, scanner.added,
+        scanner.duplicate, scanner.failed);
+    if (scanner.filter != NULL)
+        printf(", %d filtered out", scanner.filtered);
+    printf(".\n");
     printf("Database '%s' was successfully %s.\n", db_path, initialize_db ? "created" : "updated");
+    stats_end(&phases[PHASE_TOTAL], &run, 0, 0);
+    if (stats || (stats_json != NULL))
+        print_stats(phases, &scanner, db, stats, stats_json);
     ret = 0;
 
 out:
-    remove(zrif_tmp);
+    for (int i = 0; i < nb_sources; i++) {
+        safe_close(sources[i].fd);
+        remove(sources[i].tmp_path);
+        free(sources[i].url);
+        free(sources[i].buf);
+        free(sources[i].members);
+        rif_dir_free(&sources[i].dir);
+    }
     if (errmsg != NULL)
         sqlite3_free(errmsg);
+    sqlite3_close(file_db);
     sqlite3_close(db);
-    free(buf);
+    if (use_cache)
+        rif_cache_close(&cache);
+    rif_cache_writer_free(scanner.cache);
+    filter_free(&filter);
     safe_close(fd);
 
 #if defined(__vita__)
@@ -0,0 +1,402 @@
+/*
+  Vitali - Vita License database updater
+  Copyright © 2017-2018 - VitaSmith
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include "xml.h"
+
+enum {
+    XML_TEXT,
+    XML_TAG,            /* right after '<' */
+    XML_NAME,
+    XML_ATTRS,
+    XML_ATTR_NAME,
+    XML_ATTR_EQ,
+    XML_ATTR_VALUE,
+    XML_BANG,           /* right after "<!" */
+    XML_COMMENT,
+    XML_CDATA,
+    XML_DECL,           /* <?...?> or <!DOCTYPE...> */
+    XML_ENTITY,
+};
+
+static const char separator[] = "\n";
+static const char space[] = " ";
+static const char brackets[] = "]]";
+static const char cdata[] = "[CDATA[";
+
+static inline bool is_space(char c)
+{
+    return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n');
+}
+
+static inline bool is_name(const char* str, size_t len, const char* name)
+{
+    return (len == strlen(name)) && (memcmp(str, name, len) == 0);
+}
+
+void xml_init(xml_parser* xml)
+{
+    memset(xml, 0, sizeof(*xml));
+    xml->state = XML_TEXT;
+}
+
+/* Update where we are in the document once a tag is complete, returning a separator if a cell just ended */
+static const char* end_tag(xml_parser* xml)
+{
+    xml->state = XML_TEXT;
+    if (is_name(xml->name, xml->name_len, "rPh")) {
+        if (!xml->empty)
+            xml->in_phonetic = !xml->closing;
+    } else if (is_name(xml->name, xml->name_len, "si") || is_name(xml->name, xml->name_len, "is")) {
+        if (xml->closing) {
+            xml->in_string = false;
+            return separator;
+        }
+        xml->in_string = !xml->empty;
+    } else if (is_name(xml->name, xml->name_len, "t") || is_name(xml->name, xml->name_len, "v")) {
+        if (xml->closing) {
+            xml->in_text = false;
+            /* Rich text runs are all part of the same string */
+            if (!xml->in_string)
+                return separator;
+        } else if (!xml->empty) {
+            xml->in_text = true;
+            xml->preserve = xml->preserve_attr;
+            xml->text_started = false;
+            xml->pending_space = false;
+        }
+    }
+    return NULL;
+}
+
+/* Decode the entity reference that was just read, or return it as is if we don't know it */
+static const char* decode_entity(xml_parser* xml, size_t* len)
+{
+    static const struct { const char* name; char c; } entities[] = {
+        { "amp", '&' }, { "lt", '<' }, { "gt", '>' }, { "quot", '"' }, { "apos", '\'' }
+    };
+    const char* name = &xml->entity[1];
+    size_t i, name_len = xml->entity_len - 1;
+    uint32_t cp = 0;
+    int base = 10, digit;
+
+    for (i = 0; i < sizeof(entities) / sizeof(entities[0]); i++) {
+        if (is_name(name, name_len, entities[i].name)) {
+            xml->decoded[0] = entities[i].c;
+            *len = 1;
+            return xml->decoded;
+        }
+    }
+    if ((name_len < 2) || (name[0] != '#'))
+        goto raw;
+    i = 1;
+    if ((name[1] == 'x') || (name[1] == 'X')) {
+        base = 16;
+        i++;
+    }
+    if (i >= name_len)
+        goto raw;
+    for (; i < name_len; i++) {
+        if ((name[i] >= '0') && (name[i] <= '9'))
+            digit = name[i] - '0';
+        else if ((base == 16) && ((name[i] | 0x20) >= 'a') && ((name[i] | 0x20) <= 'f'))
+            digit = (name[i] | 0x20) - 'a' + 10;
+        else
+            goto raw;
+        cp = cp * base + digit;
+        if (cp > 0x10FFFF)
+            goto raw;
+    }
+    /* Encode the character reference as UTF-8 */
+    if (cp < 0x80) {
+        xml->decoded[0] = (char)cp;
+        *len = 1;
+    } else if (cp < 0x800) {
+        xml->decoded[0] = (char)(0xC0 | (cp >> 6));
+        xml->decoded[1] = (char)(0x80 | (cp & 0x3F));
+        *len = 2;
+    } else if (cp < 0x10000) {
+        xml->decoded[0] = (char)(0xE0 | (cp >> 12));
+        xml->decoded[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        xml->decoded[2] = (char)(0x80 | (cp & 0x3F));
+        *len = 3;
+    } else {
+        xml->decoded[0] = (char)(0xF0 | (cp >> 18));
+        xml->decoded[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+        xml->decoded[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        xml->decoded[3] = (char)(0x80 | (cp & 0x3F));
+        *len = 4;
+    }
+    return xml->decoded;
+
+raw:
+    *len = xml->entity_len;
+    return xml->entity;
+}
+
+const char* xml_next_text(xml_parser* xml, const char** pos, const char* end, size_t* len)
+{
+    const char *p = *pos, *s = NULL;
+    size_t n;
+    char c;
+
+    while (p < end) {
+        c = *p;
+        switch (xml->state) {
+        case XML_TEXT:
+            if (!xml->in_text || xml->in_phonetic) {
+                /* Nothing of interest until the next tag */
+                p = memchr(p, '<', end - p);
+                if (p == NULL) {
+                    p = end;
+                    break;
+                }
+                c = '<';
+            }
+            if (c == '<') {
+                p++;
+                xml->state = XML_TAG;
+                break;
+            }
+            /* Leading and trailing whitespace is dropped, and inner runs of it are kept as a single space */
+            if (!xml->preserve && is_space(c)) {
+                xml->pending_space = xml->text_started;
+                while ((p < end) && is_space(*p))
+                    p++;
+                break;
+            }
+            if (xml->pending_space) {
+                xml->pending_space = false;
+                *len = 1;
+                s = space;
+                goto out;
+            }
+            if (c == '&') {
+                p++;
+                xml->entity[0] = '&';
+                xml->entity_len = 1;
+                xml->state = XML_ENTITY;
+                break;
+            }
+            for (s = p; (p < end) && (*p != '<') && (*p != '&') && (xml->preserve || !is_space(*p)); p++);
+            xml->text_started = true;
+            *len = p - s;
+            goto out;
+
+        case XML_TAG:
+            xml->name_len = 0;
+            xml->closing = false;
+            xml->empty = false;
+            xml->preserve_attr = false;
+            if (c == '/') {
+                p++;
+                xml->closing = true;
+                xml->state = XML_NAME;
+            } else if (c == '!') {
+                p++;
+                xml->state = XML_BANG;
+            } else if (c == '?') {
+                p++;
+                xml->state = XML_DECL;
+            } else {
+                xml->state = XML_NAME;
+            }
+            break;
+
+        case XML_NAME:
+            p++;
+            if (c == '>') {
+                if ((s = end_tag(xml)) != NULL)
+                    goto separate;
+            } else if (c == '/') {
+                xml->empty = true;
+                xml->state = XML_ATTRS;
+            } else if (is_space(c)) {
+                xml->state = XML_ATTRS;
+            } else if (c == ':') {
+                /* Namespace prefixes are ignored */
+                xml->name_len = 0;
+            } else if (xml->name_len < sizeof(xml->name)) {
+                xml->name[xml->name_len++] = c;
+            }
+            break;
+
+        case XML_ATTRS:
+            p++;
+            if (c == '>') {
+                if ((s = end_tag(xml)) != NULL)
+                    goto separate;
+            } else if (c == '/') {
+                xml->empty = true;
+            } else if (!is_space(c)) {
+                xml->attr[0] = c;
+                xml->attr_len = 1;
+                xml->state = XML_ATTR_NAME;
+            }
+            break;
+
+        case XML_ATTR_NAME:
+            p++;
+            if ((c == '=') || is_space(c)) {
+                xml->state = XML_ATTR_EQ;
+            } else if (c == '>') {
+                if ((s = end_tag(xml)) != NULL)
+                    goto separate;
+            } else if (xml->attr_len < sizeof(xml->attr)) {
+                xml->attr[xml->attr_len++] = c;
+            }
+            break;
+
+        case XML_ATTR_EQ:
+            p++;
+            if ((c == '"') || (c == '\'')) {
+                xml->quote = c;
+                xml->value_len = 0;
+                xml->state = XML_ATTR_VALUE;
+            } else if (c == '>') {
+                if ((s = end_tag(xml)) != NULL)
+                    goto separate;
+            }
+            break;
+
+        case XML_ATTR_VALUE:
+            s = memchr(p, xml->quote, end - p);
+            n = ((s == NULL) ? end : s) - p;
+            if (n > sizeof(xml->value) - xml->value_len) {
+                /* Too long to be a value we care about */
+                xml->value_len = sizeof(xml->value);
+            } else {
+                memcpy(&xml->value[xml->value_len], p, n);
+                xml->value_len += (uint8_t)n;
+            }
+            if (s == NULL) {
+                p = end;
+                break;
+            }
+            p = s + 1;
+            s = NULL;
+            if (is_name(xml->attr, xml->attr_len, "xml:space"))
+                xml->preserve_attr = is_name(xml->value, xml->value_len, "preserve");
+            xml->state = XML_ATTRS;
+            break;
+
+        case XML_BANG:
+            /* Tell comments from CDATA sections and declarations, one character at a time */
+            p++;
+            xml->name[xml->name_len++] = c;
+            if ((c == '-') && (xml->name[0] == '-') && (xml->name_len <= 2)) {
+                if (xml->name_len == 2) {
+                    xml->match = 0;
+                    xml->state = XML_COMMENT;
+                }
+            } else if (c == cdata[xml->name_len - 1]) {
+                if (xml->name_len == sizeof(cdata) - 1) {
+                    xml->match = 0;
+                    xml->state = XML_CDATA;
+                }
+            } else {
+                xml->state = (c == '>') ? XML_TEXT : XML_DECL;
+            }
+            break;
+
+        case XML_COMMENT:
+            for (; p < end; p++) {
+                if (*p == '-') {
+                    if (xml->match < 2)
+                        xml->match++;
+                } else if ((*p == '>') && (xml->match == 2)) {
+                    p++;
+                    xml->state = XML_TEXT;
+                    break;
+                } else {
+                    xml->match = 0;
+                }
+            }
+            break;
+
+        case XML_CDATA:
+            /* CDATA is text as is, up to the "]]>" that ends it */
+            if ((c == '>') && (xml->match == 2)) {
+                p++;
+                xml->match = 0;
+                xml->state = XML_TEXT;
+                break;
+            }
+            if ((c == ']') && (xml->match < 2)) {
+                p++;
+                xml->match++;
+                break;
+            }
+            if ((xml->match == 0) && !xml->preserve && is_space(c)) {
+                xml->pending_space = xml->text_started;
+                while ((p < end) && is_space(*p))
+                    p++;
+                break;
+            }
+            if (xml->pending_space) {
+                xml->pending_space = false;
+                *len = 1;
+                s = space;
+            } else if (xml->match != 0) {
+                /* These brackets were text after all, or only the first one if a third follows */
+                *len = (c == ']') ? 1 : xml->match;
+                xml->match -= (uint8_t)*len;
+                s = brackets;
+            } else {
+                for (s = p; (p < end) && (*p != ']') && (xml->preserve || !is_space(*p)); p++);
+                *len = p - s;
+            }
+            if (!xml->in_text || xml->in_phonetic)
+                break;
+            xml->text_started = true;
+            goto out;
+
+        case XML_DECL:
+            p = memchr(p, '>', end - p);
+            if (p == NULL) {
+                p = end;
+                break;
+            }
+            p++;
+            xml->state = XML_TEXT;
+            break;
+
+        case XML_ENTITY:
+            if ((c != ';') && (c != '<') && (c != '&') && !is_space(c) && (xml->entity_len < sizeof(xml->entity))) {
+                p++;
+                xml->entity[xml->entity_len++] = c;
+                break;
+            }
+            if (c == ';')
+                p++;
+            xml->state = XML_TEXT;
+            xml->text_started = true;
+            s = decode_entity(xml, len);
+            goto out;
+        }
+    }
+    *pos = p;
+    return NULL;
+
+separate:
+    *len = sizeof(separator) - 1;
+out:
+    *pos = p;
+    return s;
+}
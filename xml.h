@@ -0,0 +1,69 @@
+/*
+  Vitali - Vita License database updater
+  Copyright © 2017-2018 - VitaSmith
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Streaming tokenizer for the XML parts of XLSX files (sharedStrings.xml and
+ * the worksheets), that only hands out the text of the cells, i.e. that of the
+ * <t> elements of <si> shared strings and <is> inline strings, including each
+ * <r> rich text run, as well as that of <v> values. Markup, run properties and
+ * phonetic runs (<rPh>) are skipped, entities are decoded, and whitespace is
+ * preserved only where xml:space says so. The whole state lives in the parser,
+ * so that the XML can be fed in chunks of any size without ever being held in
+ * memory, and nothing is allocated.
+ */
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct {
+    int state;
+    /* Local name of the current element, truncated, and attribute being read */
+    char name[8];
+    uint8_t name_len;
+    char attr[16];
+    uint8_t attr_len;
+    char value[16];
+    uint8_t value_len;
+    char quote;
+    bool closing, empty, preserve_attr;
+    /* Where we are in the document */
+    bool in_string;             /* within <si> or <is> */
+    bool in_phonetic;           /* within <rPh> */
+    bool in_text;               /* within <t> or <v> */
+    bool preserve;              /* xml:space="preserve" on the current <t> */
+    bool text_started, pending_space;
+    /* Characters matched of the "-->", "]]>" or "?>" that ends a markup section */
+    uint8_t match;
+    /* Entity reference being read, including the '&', and its decoded value */
+    char entity[12];
+    uint8_t entity_len;
+    char decoded[4];
+} xml_parser;
+
+void xml_init(xml_parser* xml);
+
+/*
+ * Return the next span of cell text from the chunk at [*pos, end), setting
+ * len to its size and moving *pos past it, or NULL once the chunk has been
+ * consumed. Cells are each terminated by a '\n'. Spans point either into the
+ * chunk or into the parser, for decoded entities, and are only valid until
+ * the next call.
+ */
+const char* xml_next_text(xml_parser* xml, const char** pos, const char* end, size_t* len);
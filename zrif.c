@@ -19,23 +19,43 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <assert.h>
 
 #include "zrif.h"
 #include "puff.h"
+#include "unzip.h"
+#include "stats.h"
+#include "simd.h"
 
 #define BASE_RIF_SIZE 512
 
-#define ADLER32_MOD 65521
-
 #define ZLIB_DEFLATE_METHOD 8
 #define ZLIB_DICTIONARY_ID_ZRIF 0x627d1d5d
+/* zRIFs use a 1 KB window (CINFO = 2), maximum compression and a preset dictionary */
+#define ZLIB_HEADER_ZRIF 0x28ee
+#define ZRIF_WINDOW_SIZE 1024
+
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+/* Chain length and match length after which we stop looking for a better match */
+#define MAX_CHAIN 64
+#define NICE_MATCH 32
+#define MAX_DISTANCE 32768
+#define ZRIF_HASH_BITS 11
+#define HASH_BITS 15
 
 static inline uint32_t getbe32(const uint8_t* bytes)
 {
     return (bytes[3]) | (bytes[2] << 8) | (bytes[1] << 16) | (bytes[0] << 24);
 }
 
+static inline void setbe32(uint8_t* bytes, uint32_t val)
+{
+    bytes[0] = (uint8_t)(val >> 24);
+    bytes[1] = (uint8_t)(val >> 16);
+    bytes[2] = (uint8_t)(val >> 8);
+    bytes[3] = (uint8_t)val;
+}
+
 static const uint8_t zrif_dict[] = {
     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -85,20 +105,180 @@ static const uint8_t b64d[] = {
     64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
 };
 
-static uint32_t adler32(const uint8_t* data, size_t size)
+static const char b64e[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* Size base and extra bits for length codes 257..285 and distance codes 0..29 */
+static const uint16_t lens[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t lext[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t dists[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577 };
+static const uint8_t dext[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+typedef struct {
+    uint8_t* out;
+    size_t pos, len;
+    uint32_t bitbuf;
+    int bitcnt;
+} bit_writer;
+
+/* Write the n low bits of val, least significant bit first */
+static void put_bits(bit_writer* w, uint32_t val, int n)
 {
-    uint32_t a = 1;
-    uint32_t b = 0;
+    w->bitbuf |= val << w->bitcnt;
+    w->bitcnt += n;
+    while (w->bitcnt >= 8) {
+        if (w->pos < w->len)
+            w->out[w->pos] = (uint8_t)w->bitbuf;
+        w->pos++;
+        w->bitbuf >>= 8;
+        w->bitcnt -= 8;
+    }
+}
 
-    for (size_t i = 0; i < size; i++) {
-        a = (a + data[i]) % ADLER32_MOD;
-        b = (b + a) % ADLER32_MOD;
+/* Huffman codes are packed starting with their most significant bit */
+static void put_code(bit_writer* w, uint32_t code, int n)
+{
+    uint32_t rev = 0;
+    for (int i = 0; i < n; i++, code >>= 1)
+        rev = (rev << 1) | (code & 1);
+    put_bits(w, rev, n);
+}
+
+/* Write a literal/length symbol using the fixed Huffman code */
+static void put_fixed_symbol(bit_writer* w, int symbol)
+{
+    if (symbol < 144)
+        put_code(w, 0x30 + symbol, 8);
+    else if (symbol < 256)
+        put_code(w, 0x190 + symbol - 144, 9);
+    else if (symbol < 280)
+        put_code(w, symbol - 256, 7);
+    else
+        put_code(w, 0xc0 + symbol - 280, 8);
+}
+
+static void put_match(bit_writer* w, int len, int dist)
+{
+    int i;
+
+    for (i = 28; lens[i] > len; i--);
+    put_fixed_symbol(w, 257 + i);
+    put_bits(w, len - lens[i], lext[i]);
+    for (i = 29; dists[i] > dist; i--);
+    put_code(w, i, 5);
+    put_bits(w, dist - dists[i], dext[i]);
+}
+
+static inline uint32_t hash3(const uint8_t* p, int bits)
+{
+    return ((p[0] << 10) ^ (p[1] << 5) ^ p[2]) & ((1 << bits) - 1);
+}
+
+size_t deflate_fixed(const uint8_t* buf, size_t dictlen, size_t len, size_t window, uint8_t* out, size_t out_len)
+{
+    /* A small table is enough for the zRIF window, and much cheaper to reset */
+    int hash_bits = (window <= ZRIF_WINDOW_SIZE) ? ZRIF_HASH_BITS : HASH_BITS;
+    size_t i, end = dictlen + len, mask = 1;
+    bit_writer w = { out, 0, out_len, 0, 0 };
+
+    if (window > MAX_DISTANCE)
+        window = MAX_DISTANCE;
+    /* prev[] is a ring, which must not wrap over the positions that are within the window */
+    while (mask <= window)
+        mask <<= 1;
+    mask--;
+    int32_t* head = malloc(((size_t)1 << hash_bits) * sizeof(int32_t));
+    int32_t* prev = malloc((mask + 1) * sizeof(int32_t));
+    if ((head == NULL) || (prev == NULL)) {
+        free(head);
+        free(prev);
+        return 0;
     }
+    memset(head, 0xff, ((size_t)1 << hash_bits) * sizeof(int32_t));
+    put_bits(&w, 1, 1);     /* last block */
+    put_bits(&w, 1, 2);     /* fixed codes */
 
-    return (b << 16) | a;
+    for (i = 0; i + MIN_MATCH <= end; ) {
+        int best_len = 0, best_dist = 0, chain = MAX_CHAIN;
+        uint32_t h = hash3(&buf[i], hash_bits);
+        if (i >= dictlen) {
+            size_t max_len = end - i;
+            if (max_len > MAX_MATCH)
+                max_len = MAX_MATCH;
+            for (int32_t j = head[h]; (j >= 0) && (i - j <= window) && (chain-- > 0); j = prev[j & mask]) {
+                int l = 0;
+                while (((size_t)l < max_len) && (buf[j + l] == buf[i + l]))
+                    l++;
+                if (l > best_len) {
+                    best_len = l;
+                    best_dist = (int)(i - j);
+                    if (((size_t)l == max_len) || (l >= NICE_MATCH))
+                        break;
+                }
+            }
+        }
+        int n = (best_len >= MIN_MATCH) ? best_len : 1;
+        if (i >= dictlen) {
+            if (n > 1)
+                put_match(&w, best_len, best_dist);
+            else
+                put_fixed_symbol(&w, buf[i]);
+        }
+        /* Insert all the positions we skip over in the hash chains */
+        while (n-- > 0) {
+            if (i + MIN_MATCH <= end) {
+                h = hash3(&buf[i], hash_bits);
+                prev[i & mask] = head[h];
+                head[h] = (int32_t)i;
+            }
+            i++;
+        }
+    }
+    for (; i < end; i++)
+        put_fixed_symbol(&w, buf[i]);
+
+    put_fixed_symbol(&w, 256);  /* end of block */
+    put_bits(&w, 0, 7);         /* flush */
+    free(head);
+    free(prev);
+    return w.pos;
 }
 
-static size_t base64_decode(const char* in, uint8_t* out)
+static size_t base64_encode(const uint8_t* in, size_t len, char* out)
+{
+    const char* out0 = out;
+
+    for (; len >= 3; len -= 3, in += 3) {
+        *out++ = b64e[in[0] >> 2];
+        *out++ = b64e[((in[0] & 0x03) << 4) | (in[1] >> 4)];
+        *out++ = b64e[((in[1] & 0x0f) << 2) | (in[2] >> 6)];
+        *out++ = b64e[in[2] & 0x3f];
+    }
+    if (len > 0) {
+        *out++ = b64e[in[0] >> 2];
+        if (len == 1) {
+            *out++ = b64e[(in[0] & 0x03) << 4];
+            *out++ = '=';
+        } else {
+            *out++ = b64e[((in[0] & 0x03) << 4) | (in[1] >> 4)];
+            *out++ = b64e[(in[1] & 0x0f) << 2];
+        }
+        *out++ = '=';
+    }
+    *out = 0;
+
+    return (size_t)(out - out0);
+}
+
+size_t base64_decode(const char* in, uint8_t* out)
 {
     const uint8_t* out0 = out;
     const uint8_t* in8 = (uint8_t*)in;
@@ -129,60 +309,288 @@ static size_t base64_decode(const char* in, uint8_t* out)
     return (size_t)(out - out0);
 }
 
-static size_t zlib_inflate(const uint8_t* in, size_t inlen, uint8_t* out, size_t outlen)
+static inline bool is_zrif_char(char c)
+{
+    return ((c >= 'A') && (c <= 'Z')) || ((c >= 'a') && (c <= 'z')) || ((c >= '0') && (c <= '9')) ||
+        (c == '+') || (c == '/') || (c == '=');
+}
+
+const char* zrif_span(const char* p, const char* end)
+{
+#if defined(USE_SSE2)
+    /* Signed compares, so bytes above 0x7f are outside of every range */
+    const __m128i upper_lo = _mm_set1_epi8('A' - 1), upper_hi = _mm_set1_epi8('Z' + 1);
+    const __m128i lower_lo = _mm_set1_epi8('a' - 1), lower_hi = _mm_set1_epi8('z' + 1);
+    const __m128i digit_lo = _mm_set1_epi8('0' - 1), digit_hi = _mm_set1_epi8('9' + 1);
+    const __m128i plus = _mm_set1_epi8('+'), slash = _mm_set1_epi8('/'), equal = _mm_set1_epi8('=');
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        __m128i ok = _mm_or_si128(
+            _mm_or_si128(_mm_and_si128(_mm_cmpgt_epi8(v, upper_lo), _mm_cmplt_epi8(v, upper_hi)),
+                _mm_and_si128(_mm_cmpgt_epi8(v, lower_lo), _mm_cmplt_epi8(v, lower_hi))),
+            _mm_or_si128(_mm_and_si128(_mm_cmpgt_epi8(v, digit_lo), _mm_cmplt_epi8(v, digit_hi)),
+                _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, plus), _mm_cmpeq_epi8(v, slash)), _mm_cmpeq_epi8(v, equal))));
+        int mask = ~_mm_movemask_epi8(ok) & 0xffff;
+        if (mask != 0)
+            return p + ctz((unsigned int)mask);
+    }
+#elif defined(USE_NEON)
+    const uint8x16_t upper = vdupq_n_u8('A'), lower = vdupq_n_u8('a'), digit = vdupq_n_u8('0');
+    const uint8x16_t letters = vdupq_n_u8(26), digits = vdupq_n_u8(10);
+    const uint8x16_t plus = vdupq_n_u8('+'), slash = vdupq_n_u8('/'), equal = vdupq_n_u8('=');
+    for (; end - p >= 16; p += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t*)p);
+        /* Unsigned wraparound turns each range check into a single compare */
+        uint8x16_t ok = vorrq_u8(vorrq_u8(vcltq_u8(vsubq_u8(v, upper), letters), vcltq_u8(vsubq_u8(v, lower), letters)),
+            vorrq_u8(vcltq_u8(vsubq_u8(v, digit), digits),
+                vorrq_u8(vorrq_u8(vceqq_u8(v, plus), vceqq_u8(v, slash)), vceqq_u8(v, equal))));
+        uint8x8_t t = vand_u8(vget_low_u8(ok), vget_high_u8(ok));
+        /* Leave it to the loop below to find out which of the 16 bytes is not a zRIF character */
+        if (vget_lane_u64(vreinterpret_u64_u8(t), 0) != ~0ULL)
+            break;
+    }
+#endif
+    while ((p < end) && is_zrif_char(*p))
+        p++;
+    return p;
+}
+
+/*
+ * Validate the zlib header and, if a preset dictionary is used, copy it into
+ * out. Returns ZRIF_OK with the size of the header in hdrlen, or a ZRIF_ERR_xxx.
+ */
+static int zlib_header(const uint8_t* in, size_t inlen, uint8_t* out, size_t outlen, size_t* hdrlen, size_t* dictlen)
 {
     if (inlen < 2 + 4)
-        return 0;
+        return ZRIF_ERR_LENGTH;
 
     if (((in[0] << 8) + in[1]) % 31 != 0)
-        return 0;
+        return ZRIF_ERR_HEADER;
 
     if ((in[0] & 0xf) != ZLIB_DEFLATE_METHOD)
-        return 0;
-
-    size_t slen = inlen - 4;
-    size_t dlen = outlen;
-    size_t dictlen = 0;
+        return ZRIF_ERR_HEADER;
 
+    *dictlen = 0;
+    *hdrlen = 2;
     if (in[1] & (1 << 5)) {
-        assert(outlen > sizeof(zrif_dict));
+        if (inlen < 6 + 4)
+            return ZRIF_ERR_LENGTH;
+        if ((outlen <= sizeof(zrif_dict)) || (getbe32(in + 2) != ZLIB_DICTIONARY_ID_ZRIF))
+            return ZRIF_ERR_DICTIONARY;
         memcpy(out, zrif_dict, sizeof(zrif_dict));
-        dictlen = sizeof(zrif_dict);
-        if (getbe32(in + 2) != ZLIB_DICTIONARY_ID_ZRIF)
-            return 0;
-        in += 6;
-        slen -= 6;
-    } else {
-        in += 2;
-        slen -= 2;
+        *dictlen = sizeof(zrif_dict);
+        *hdrlen = 6;
     }
+    return ZRIF_OK;
+}
 
-    int r = puff(dictlen, out, &dlen, in, &slen);
-    if (r < 0)
-        return 0;
+/* in must be followed by PUFF_PAD readable bytes. phases, if not NULL, get the time spent */
+static int zlib_inflate(const uint8_t* in, size_t inlen, uint8_t* out, size_t* outlen, phase_stats* phases)
+{
+    uint64_t t = (phases != NULL) ? stats_clock() : 0;
+    size_t hdrlen, dictlen;
+    int r = zlib_header(in, inlen, out, *outlen, &hdrlen, &dictlen);
+    if (r != ZRIF_OK)
+        return r;
+
+    size_t slen = inlen - hdrlen - 4;
+    size_t dlen = *outlen;
+    in += hdrlen;
+
+    r = puff_padded(dictlen, out, &dlen, in, &slen);
+    if (phases != NULL)
+        t = stats_add(&phases[PHASE_INFLATE], t, dlen);
+    if (r != 0)
+        return ZRIF_ERR_INFLATE;
     memmove(out, out + dictlen, dlen);
 
-    if (adler32(out, dlen) != getbe32(in + slen))
-        return 0;
+    r = (zip_adler32(1, out, dlen) == getbe32(in + slen)) ? ZRIF_OK : ZRIF_ERR_ADLER32;
+    if (phases != NULL)
+        stats_add(&phases[PHASE_ADLER32], t, dlen);
+    if (r != ZRIF_OK)
+        return r;
 
-    return dlen;
+    *outlen = dlen;
+    return ZRIF_OK;
 }
 
-size_t decode_zrif(const char* zrif, uint8_t* dst, const size_t dst_len)
+/* Decode a zRIF into dst, which must be able to hold a PSM RIF */
+static int zrif_decode(const char* zrif, uint8_t* dst, size_t* rif_len, phase_stats* phases)
 {
     /* PSM RIFs are twice the base RIF size */
-    uint8_t raw[2 * BASE_RIF_SIZE];
-    uint8_t out[2 * BASE_RIF_SIZE + sizeof(zrif_dict)];
-    size_t rif_len = 0;
+    uint8_t raw[2 * BASE_RIF_SIZE + PUFF_PAD];
+    uint8_t out[2 * BASE_RIF_SIZE + sizeof(zrif_dict) + PUFF_SLACK];
+    size_t len = strlen(zrif), out_len = sizeof(out);
+    int r;
+
+    /* Don't overflow raw[] on oversized input */
+    if ((len == 0) || (len > 4 * (2 * BASE_RIF_SIZE) / 3))
+        return ZRIF_ERR_LENGTH;
+
+    if (phases != NULL) {
+        uint64_t t = stats_clock();
+        len = base64_decode(zrif, raw);
+        stats_add(&phases[PHASE_BASE64], t, len);
+    } else {
+        len = base64_decode(zrif, raw);
+    }
+    memset(&raw[len], 0, PUFF_PAD);
+    r = zlib_inflate(raw, len, out, &out_len, phases);
+    if (r != ZRIF_OK)
+        return r;
+    if ((out_len != BASE_RIF_SIZE) && (out_len != 2 * BASE_RIF_SIZE))
+        return ZRIF_ERR_SIZE;
+
+    memcpy(dst, out, out_len);
+    *rif_len = out_len;
+    return ZRIF_OK;
+}
+
+size_t decode_zrif_stats(const char* zrif, uint8_t* dst, const size_t dst_len, phase_stats* phases)
+{
+    size_t rif_len;
 
     if (dst_len < 2 * BASE_RIF_SIZE)
         return 0;
+    return (zrif_decode(zrif, dst, &rif_len, phases) == ZRIF_OK) ? rif_len : 0;
+}
+
+size_t decode_zrif(const char* zrif, uint8_t* dst, const size_t dst_len)
+{
+    return decode_zrif_stats(zrif, dst, dst_len, NULL);
+}
+
+/* Padding may only appear at the end, and base64_decode() ignores invalid characters */
+static bool is_base64(const char* str)
+{
+    size_t i, len = strlen(str), pad = 0;
+
+    while ((pad < 2) && (len > pad) && (str[len - pad - 1] == '='))
+        pad++;
+    for (i = 0; i < len - pad; i++) {
+        if (b64d[(uint8_t)str[i]] == 64)
+            return false;
+    }
+    return ((len - pad) % 4 != 1) && ((pad == 0) || (len % 4 == 0));
+}
+
+/* CONTENT_IDs look like UP0001-PCSE00001_00-0000000000000001 */
+static bool is_content_id(const char* id)
+{
+    static const char* shape = "AA9999-AAAA99999_99-XXXXXXXXXXXXXXXX";
+    size_t i;
+
+    for (i = 0; shape[i] != 0; i++) {
+        switch (shape[i]) {
+        case 'A':
+            if ((id[i] < 'A') || (id[i] > 'Z'))
+                return false;
+            break;
+        case '9':
+            if ((id[i] < '0') || (id[i] > '9'))
+                return false;
+            break;
+        case 'X':
+            if (((id[i] < 'A') || (id[i] > 'Z')) && ((id[i] < '0') || (id[i] > '9')) && (id[i] != '_'))
+                return false;
+            break;
+        default:
+            if (id[i] != shape[i])
+                return false;
+            break;
+        }
+    }
+    return (id[i] == 0);
+}
+
+int check_rif(const uint8_t* rif, const size_t rif_len)
+{
+    if ((rif_len != BASE_RIF_SIZE) && (rif_len != 2 * BASE_RIF_SIZE))
+        return ZRIF_ERR_SIZE;
+    return is_content_id(rif_content_id(rif)) ? ZRIF_OK : ZRIF_ERR_CONTENT_ID;
+}
+
+int check_zrif(const char* zrif)
+{
+    uint8_t rif[2 * BASE_RIF_SIZE];
+    size_t rif_len;
+    int r;
+
+    if (!is_base64(zrif))
+        return ZRIF_ERR_BASE64;
+    r = zrif_decode(zrif, rif, &rif_len, NULL);
+    if (r != ZRIF_OK)
+        return r;
+    return check_rif(rif, rif_len);
+}
+
+const char* zrif_strerror(int err)
+{
+    static const char* errors[ZRIF_ERR_MAX] = {
+        "valid",
+        "invalid length",
+        "invalid base64",
+        "invalid zlib header",
+        "unknown dictionary",
+        "invalid deflate data",
+        "Adler-32 mismatch",
+        "invalid RIF size",
+        "invalid CONTENT_ID",
+    };
+    return ((err >= 0) && (err < ZRIF_ERR_MAX)) ? errors[err] : "unknown error";
+}
+
+size_t encode_zrif(const uint8_t* rif, const size_t rif_len, char* dst, const size_t dst_len)
+{
+    uint8_t buf[2 * BASE_RIF_SIZE + sizeof(zrif_dict)];
+    /* Fixed Huffman codes never expand data by more than 9/8 */
+    uint8_t raw[2 + 4 + (9 * 2 * BASE_RIF_SIZE) / 8 + 8 + 4];
+    size_t raw_len;
 
-    rif_len = base64_decode(zrif, raw);
-    rif_len = zlib_inflate(raw, rif_len, out, sizeof(out));
     if ((rif_len != BASE_RIF_SIZE) && (rif_len != 2 * BASE_RIF_SIZE))
         return 0;
 
-    memcpy(dst, out, rif_len);
-    return rif_len;
+    raw[0] = ZLIB_HEADER_ZRIF >> 8;
+    raw[1] = ZLIB_HEADER_ZRIF & 0xff;
+    setbe32(&raw[2], ZLIB_DICTIONARY_ID_ZRIF);
+    memcpy(buf, zrif_dict, sizeof(zrif_dict));
+    memcpy(&buf[sizeof(zrif_dict)], rif, rif_len);
+    raw_len = deflate_fixed(buf, sizeof(zrif_dict), rif_len, ZRIF_WINDOW_SIZE, &raw[6], sizeof(raw) - 6 - 4);
+    if ((raw_len == 0) || (6 + raw_len + 4 > sizeof(raw)))
+        return 0;
+    raw_len += 6;
+    setbe32(&raw[raw_len], zip_adler32(1, rif, rif_len));
+    raw_len += 4;
+
+    if (dst_len < 4 * ((raw_len + 2) / 3) + 1)
+        return 0;
+    return base64_encode(raw, raw_len, dst);
+}
+
+bool get_zrif_content_id(const char* zrif, char* content_id, const size_t content_id_len)
+{
+    uint8_t raw[2 * BASE_RIF_SIZE];
+    /* puff_partial() may overshoot by up to one match */
+    uint8_t out[sizeof(zrif_dict) + RIF_HEADER_SIZE + MAX_MATCH + PUFF_SLACK];
+    size_t raw_len, hdrlen, dictlen, slen, dlen = sizeof(out), i;
+    const char* id;
+
+    if ((content_id_len == 0) || (zrif[0] == 0) || (strlen(zrif) > 4 * sizeof(raw) / 3))
+        return false;
+
+    raw_len = base64_decode(zrif, raw);
+    if (zlib_header(raw, raw_len, out, sizeof(out), &hdrlen, &dictlen) != ZRIF_OK)
+        return false;
+
+    /* Only inflate as much as needed to get to the CONTENT_ID */
+    slen = raw_len - hdrlen - 4;
+    int r = puff_partial(dictlen, out, &dlen, raw + hdrlen, &slen, RIF_HEADER_SIZE);
+    if (((r != 0) && (r != 3)) || (dlen < RIF_HEADER_SIZE))
+        return false;
+
+    id = rif_content_id(&out[dictlen]);
+    for (i = 0; (i < content_id_len - 1) && (i < RIF_CONTENT_ID_MAX) && (id[i] != 0); i++)
+        content_id[i] = id[i];
+    content_id[i] = 0;
+    return (i != 0);
 }
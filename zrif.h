@@ -18,5 +18,52 @@
 
 #pragma once
 #include <stdint.h>
+#include <stdbool.h>
+
+#include "stats.h"
+
+/* CONTENT_ID is always found within the first RIF_HEADER_SIZE bytes of a RIF */
+#define RIF_HEADER_SIZE     0x80
+#define RIF_CONTENT_ID_MAX  0x30
+
+/* PSM and regular RIFs have CONTENT_ID at different offsets */
+static inline const char* rif_content_id(const uint8_t* rif)
+{
+    return (const char*)&rif[(((uint64_t*)rif)[0] == 0ULL) ? 0x50 : 0x10];
+}
 
 size_t decode_zrif(const char* zrif, uint8_t* dst, const size_t dst_len);
+/* Same as decode_zrif(), accounting for the base64, inflate and Adler-32 phases */
+size_t decode_zrif_stats(const char* zrif, uint8_t* dst, const size_t dst_len, phase_stats* phases);
+/* Extract CONTENT_ID without decoding nor validating the whole of the zRIF */
+bool get_zrif_content_id(const char* zrif, char* content_id, const size_t content_id_len);
+size_t encode_zrif(const uint8_t* rif, const size_t rif_len, char* dst, const size_t dst_len);
+/*
+ * Compress the len bytes that follow a dictlen bytes preset dictionary in buf
+ * into a single fixed Huffman deflate block, looking for matches up to window
+ * bytes back (32 KB at most). Returns the compressed size, which may exceed
+ * out_len, in which case the output is truncated, or 0 if out of memory.
+ */
+size_t deflate_fixed(const uint8_t* buf, size_t dictlen, size_t len, size_t window, uint8_t* out, size_t out_len);
+/* Decode a NUL terminated base64 string, without validating it */
+size_t base64_decode(const char* in, uint8_t* out);
+/* Return the end of the run of zRIF characters (base64, including '=') that starts at p */
+const char* zrif_span(const char* p, const char* end);
+
+/* Validation results of check_zrif() */
+#define ZRIF_OK             0
+#define ZRIF_ERR_LENGTH     1
+#define ZRIF_ERR_BASE64     2
+#define ZRIF_ERR_HEADER     3
+#define ZRIF_ERR_DICTIONARY 4
+#define ZRIF_ERR_INFLATE    5
+#define ZRIF_ERR_ADLER32    6
+#define ZRIF_ERR_SIZE       7
+#define ZRIF_ERR_CONTENT_ID 8
+#define ZRIF_ERR_MAX        9
+
+/* Fully validate a zRIF, down to the shape of its CONTENT_ID */
+int check_zrif(const char* zrif);
+/* Validate the size and the shape of the CONTENT_ID of a raw RIF */
+int check_rif(const uint8_t* rif, const size_t rif_len);
+const char* zrif_strerror(int err);